@@ -0,0 +1,743 @@
+/* Copyright Joyent, Inc. and other Node contributors.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Generate the character tables, the method matcher and the header name
+ * matcher of http_parser.c from the description at the top of this file.
+ *
+ *   make generate
+ *
+ * copies http_parser.c through this program, which rewrites every region
+ * between a BEGIN GENERATED <name> and an END GENERATED <name> comment.
+ * Edit the description, never the generated code, and commit the result.
+ */
+
+#include "http_parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DIGIT "0123456789"
+#define ALPHA "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+
+/* Bytes of a header name (rfc 7230 tchar). SP is let through as well so
+ * that the lenient parser can skip it; STRICT_TOKEN() rejects it.
+ */
+static const char tchar[] = "!#$%&'*+-.^_`|~ " DIGIT ALPHA;
+
+/* Bytes of a URL. Outside of strict mode HT and FF are accepted too. */
+static const char url_char[] =
+  "!\"$%&'()*+,-./:;<=>@[\\]^_`{|}~" DIGIT ALPHA;
+static const char url_char_lenient[] = "\t\f";
+
+static const char hexdig[] = DIGIT "abcdefABCDEF";
+
+/* Header names the parser acts on, and the header_state each one leads to
+ * once its last byte has been matched. No name may be a prefix of another.
+ */
+static const struct {
+  const char *name;
+  const char *state;
+} header_names[] = {
+  { "connection",        "h_connection" },
+  { "proxy-connection",  "h_connection" },
+  { "content-length",    "h_content_length" },
+  { "transfer-encoding", "h_transfer_encoding" },
+  { "upgrade",           "h_upgrade" },
+};
+
+/* The method assumed after the first byte of a request, for the bytes that
+ * start more than one method. It is what on_message_begin sees.
+ */
+static const char *method_guesses[] =
+  { "CONNECT", "LOCK", "MKCOL", "POST", "REPORT", "SUBSCRIBE", "UNLOCK" };
+
+
+static const struct {
+  const char *name;
+  const char *string;
+} methods[] = {
+#define XX(num, name, string) { #name, #string },
+  HTTP_METHOD_MAP(XX)
+#undef XX
+};
+
+#define NUM_METHODS (sizeof(methods) / sizeof(methods[0]))
+#define NUM_HEADER_NAMES (sizeof(header_names) / sizeof(header_names[0]))
+
+/* header_state is a 7 bit field and the value matchers need some room */
+#define MAX_NAME_STATES 96
+
+#define MAX_TRIE_NODES 256
+
+
+static void
+die(const char *msg)
+{
+  fprintf(stderr, "gen_tables: %s\n", msg);
+  exit(1);
+}
+
+
+/* Character tables */
+
+static const char *ctl_names[33] =
+  { "nul", "soh", "stx", "etx", "eot", "enq", "ack", "bel"
+  , "bs",  "ht",  "nl",  "vt",  "np",  "cr",  "so",  "si"
+  , "dle", "dc1", "dc2", "dc3", "dc4", "nak", "syn", "etb"
+  , "can", "em",  "sub", "esc", "fs",  "gs",  "rs",  "us"
+  , "sp"
+  };
+
+static void
+print_byte_comment(int row)
+{
+  char name[8];
+  int i, c;
+
+  printf("/*");
+  for (i = 0; i < 8; i++) {
+    c = row * 8 + i;
+    if (c <= ' ') {
+      snprintf(name, sizeof(name), "%s", ctl_names[c]);
+    } else if (c == 127) {
+      snprintf(name, sizeof(name), "del");
+    } else {
+      snprintf(name, sizeof(name), " %c", c);
+    }
+    printf(i < 7 ? " %3d %-4s" : " %3d %-3s */\n", c, name);
+  }
+}
+
+/* Print `s` so that its byte at `anchor` lands on column `col` */
+static int
+print_at(int pos, int col, const char *s, int anchor)
+{
+  for (; pos < col - anchor; pos++) {
+    putchar(' ');
+  }
+  fputs(s, stdout);
+  return pos + (int) strlen(s);
+}
+
+static void
+gen_char_classes(void)
+{
+  char s[16];
+  int row, i, c, pos;
+
+  printf("/* Tokens as defined by rfc 2616. Also lowercases them.\n"
+         " *        token       = 1*<any CHAR except CTLs or separators>\n"
+         " *     separators     = \"(\" | \")\" | \"<\" | \">\" | \"@\"\n"
+         " *                    | \",\" | \";\" | \":\" | \"\\\" | <\">\n"
+         " *                    | \"/\" | \"[\" | \"]\" | \"?\" | \"=\"\n"
+         " *                    | \"{\" | \"}\" | SP | HT\n"
+         " */\n"
+         "static const char tokens[256] = {\n");
+  for (row = 0; row < 16; row++) {
+    print_byte_comment(row);
+    pos = 0;
+    for (i = 0; i < 8; i++) {
+      c = row * 8 + i;
+      if (c == 0 || strchr(tchar, c) == NULL) {
+        pos = print_at(pos, 8 + 9 * i, "0", 0);
+      } else {
+        int l = (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+        snprintf(s, sizeof(s), l == '\'' ? "'\\''" : "'%c'", l);
+        pos = print_at(pos, 8 + 9 * i, s, l == '\'' ? 2 : 1);
+      }
+      pos = print_at(pos, pos, (row == 15 && i == 7) ? " };" : ",", 0);
+    }
+    putchar('\n');
+  }
+
+  printf("\n\nstatic const int8_t unhex[256] =\n");
+  for (c = 0; c < 128; c++) {
+    const char *h = c == 0 ? NULL : strchr(hexdig, c);
+    printf("%s%2d", c == 0 ? "  {" : c % 16 == 0 ? "\n  ," : ",",
+           h == NULL ? -1 : c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+  }
+  printf("\n  };\n");
+
+  printf("\n\n#if HTTP_PARSER_STRICT\n"
+         "# define T(v) 0\n"
+         "#else\n"
+         "# define T(v) v\n"
+         "#endif\n"
+         "\n\n"
+         "static const uint8_t normal_url_char[32] = {\n");
+  for (row = 0; row < 16; row++) {
+    print_byte_comment(row);
+    pos = 0;
+    for (i = 0; i < 8; i++) {
+      c = row * 8 + i;
+      if (c != 0 && strchr(url_char, c) != NULL) {
+        snprintf(s, sizeof(s), "%d", 1 << i);
+      } else if (c != 0 && strchr(url_char_lenient, c) != NULL) {
+        snprintf(s, sizeof(s), "T(%d)", 1 << i);
+      } else {
+        snprintf(s, sizeof(s), "0");
+      }
+      pos = print_at(pos, 8 + 9 * i, s,
+                     (s[0] == 'T' ? 2 : 0) + ((1 << i) >= 100 && s[0] != '0'));
+      if (i < 7) {
+        pos = print_at(pos, 13 + 9 * i, "|", 0);
+      }
+    }
+    printf(row == 15 ? ", };\n" : ",\n");
+  }
+  printf("\n#undef T\n");
+}
+
+
+/* Method matcher */
+
+static int
+method_by_string(const char *s)
+{
+  unsigned int i;
+
+  for (i = 0; i < NUM_METHODS; i++) {
+    if (strcmp(methods[i].string, s) == 0) {
+      return (int) i;
+    }
+  }
+  die("unknown method guess");
+  return -1;
+}
+
+/* First method in map order that starts with the `len` bytes of `prefix` */
+static int
+method_by_prefix(const char *prefix, size_t len)
+{
+  unsigned int i;
+
+  for (i = 0; i < NUM_METHODS; i++) {
+    if (strlen(methods[i].string) >= len &&
+        memcmp(methods[i].string, prefix, len) == 0) {
+      return (int) i;
+    }
+  }
+  return -1;
+}
+
+/* Method guessed after the first byte `ch`, or -1 */
+static int
+method_start(int ch)
+{
+  unsigned int i;
+  int m = -1;
+  char s[1];
+
+  for (i = 0; i < sizeof(method_guesses) / sizeof(method_guesses[0]); i++) {
+    if (method_guesses[i][0] == ch) {
+      return method_by_string(method_guesses[i]);
+    }
+  }
+
+  s[0] = (char) ch;
+  for (i = 0; i < NUM_METHODS; i++) {
+    if (methods[i].string[0] == ch) {
+      if (m != -1) {
+        die("methods share their first byte but there is no guess");
+      }
+      m = method_by_prefix(s, 1);
+    }
+  }
+  return m;
+}
+
+static void
+gen_methods(void)
+{
+  /* Guessed methods, and the index at which the guess was made */
+  int queue[NUM_METHODS * 8][2];
+  int head = 0, tail = 0;
+  int seen[NUM_METHODS];
+  char buf[64];
+  int ch, m, i, j;
+
+  memset(seen, 0, sizeof(seen));
+
+  printf("/* Start the method matcher on the first byte `ch` of a request.\n"
+         " * Returns 0 if no known method starts with it.\n"
+         " */\n"
+         "static int\n"
+         "match_method_start(unsigned int *method, char ch)\n"
+         "{\n"
+         "  switch (ch) {\n");
+  for (ch = 'A'; ch <= 'Z'; ch++) {
+    m = method_start(ch);
+    if (m == -1) {
+      continue;
+    }
+    printf("    case '%c': *method = HTTP_%s; break;\n", ch, methods[m].name);
+    queue[tail][0] = m;
+    queue[tail++][1] = 0;
+    seen[m] = 1;
+  }
+  printf("    default:\n"
+         "      return 0;\n"
+         "  }\n"
+         "\n"
+         "  return 1;\n"
+         "}\n"
+         "\n\n");
+
+  printf("/* Advance the method matcher by the `index`th byte `ch` of the method name.\n"
+         " * Returns 0 if no known method starts with the bytes seen so far.\n"
+         " */\n"
+         "static int\n"
+         "match_method_char(unsigned int *method, unsigned int index, char ch)\n"
+         "{\n"
+         "  if (ch == method_strings[*method][index]) {\n"
+         "    return 1;\n"
+         "  }\n"
+         "\n"
+         "  if (!((ch >= 'A' && ch <= 'Z') || ch == '-')) {\n"
+         "    return 0;\n"
+         "  }\n"
+         "\n"
+         "  switch (*method << 16 | index << 8 | ch) {\n"
+         "#define XX(meth, pos, ch, new_meth) \\\n"
+         "    case (HTTP_##meth << 16 | pos << 8 | ch): \\\n"
+         "      *method = HTTP_##new_meth; break;\n"
+         "\n");
+
+  /* Once the bytes rule out the current method, move on to the first one
+   * that matches them. Only methods reachable that way get transitions.
+   */
+  while (head < tail) {
+    const char *s;
+
+    m = queue[head][0];
+    i = queue[head++][1];
+    s = methods[m].string;
+    for (j = i + 1; s[j] != '\0'; j++) {
+      memcpy(buf, s, j);
+      for (ch = 'A'; ch <= 'Z' + 1; ch++) {
+        int next;
+
+        buf[j] = (char) (ch > 'Z' ? '-' : ch);
+        if (buf[j] == s[j] || (next = method_by_prefix(buf, j + 1)) == -1) {
+          continue;
+        }
+        snprintf(buf + 32, 32, "%s,", methods[m].name);
+        printf("    XX(%-11s%d, '%c', %s)\n",
+               buf + 32, j, buf[j], methods[next].name);
+        if (!seen[next]) {
+          seen[next] = j + 1;
+          queue[tail][0] = next;
+          queue[tail++][1] = j;
+        } else if (j + 1 < seen[next]) {
+          die("a method is reached earlier than its transitions were made");
+        }
+      }
+    }
+  }
+
+  printf("#undef XX\n"
+         "    default:\n"
+         "      return 0;\n"
+         "  }\n"
+         "\n"
+         "  return 1;\n"
+         "}\n");
+}
+
+
+/* Header name matcher
+ *
+ * The names are put in a trie, which is then minimized by partition
+ * refinement (Moore): states that lead to the same header_state on the same
+ * bytes are merged, e.g. the "nection" tails of connection and
+ * proxy-connection. Edges to a name's final header_state are encoded as
+ * -2 - <index in header_names>, missing edges as -1.
+ */
+
+static int trie[MAX_TRIE_NODES][256];
+static int num_trie_nodes;
+
+static int block_of[MAX_TRIE_NODES];
+static int num_blocks;
+
+/* Minimized states in output order; state 0 is the start state */
+static int state_of_block[MAX_TRIE_NODES];
+static int block_of_state[MAX_TRIE_NODES];
+static int num_states;
+
+static int transitions[MAX_TRIE_NODES][256];
+
+static int byte_class[256];
+static int class_byte[256];
+static int num_classes;
+
+static int num_finals;
+static const char *finals[NUM_HEADER_NAMES];
+
+static void
+build_trie(void)
+{
+  unsigned int i, j;
+  int n;
+
+  memset(trie, -1, sizeof(trie));
+  num_trie_nodes = 1;
+
+  for (i = 0; i < NUM_HEADER_NAMES; i++) {
+    const char *name = header_names[i].name;
+    size_t len = strlen(name);
+
+    if (len == 0) {
+      die("empty header name");
+    }
+
+    n = 0;
+    for (j = 0; j < len; j++) {
+      unsigned char c = (unsigned char) name[j];
+
+      if (c >= 'A' && c <= 'Z') {
+        die("header names must be lowercase");
+      }
+      if (j == len - 1) {
+        if (trie[n][c] != -1) {
+          die("a header name is a prefix of another");
+        }
+        trie[n][c] = -2 - (int) i;
+      } else if (trie[n][c] == -1) {
+        if (num_trie_nodes == MAX_TRIE_NODES) {
+          die("too many header name bytes");
+        }
+        trie[n][c] = num_trie_nodes++;
+        n = trie[n][c];
+      } else if (trie[n][c] < -1) {
+        die("a header name is a prefix of another");
+      } else {
+        n = trie[n][c];
+      }
+    }
+  }
+}
+
+/* Final header_state of the edge `t` in terms of distinct state names */
+static int
+final_id(int t)
+{
+  const char *state = header_names[-2 - t].state;
+  int i;
+
+  for (i = 0; i < num_finals; i++) {
+    if (strcmp(finals[i], state) == 0) {
+      return i;
+    }
+  }
+  finals[num_finals] = state;
+  return num_finals++;
+}
+
+/* Where edge `t` leads in the current partition, comparable across nodes */
+static int
+edge_target(int t)
+{
+  if (t == -1) {
+    return -1;
+  }
+  if (t < -1) {
+    return -2 - final_id(t);
+  }
+  return block_of[t];
+}
+
+static void
+minimize(void)
+{
+  static int next_block[MAX_TRIE_NODES];
+  int n, m, c, changed;
+
+  /* Start with a single block and split it until nothing changes */
+  memset(block_of, 0, sizeof(block_of));
+  num_blocks = 1;
+
+  do {
+    int blocks = 0;
+
+    for (n = 0; n < num_trie_nodes; n++) {
+      next_block[n] = -1;
+      for (m = 0; m < n; m++) {
+        if (block_of[m] != block_of[n]) {
+          continue;
+        }
+        for (c = 0; c < 256; c++) {
+          if (edge_target(trie[m][c]) != edge_target(trie[n][c])) {
+            break;
+          }
+        }
+        if (c == 256) {
+          next_block[n] = next_block[m];
+          break;
+        }
+      }
+      if (next_block[n] == -1) {
+        next_block[n] = blocks++;
+      }
+    }
+
+    changed = blocks != num_blocks;
+    memcpy(block_of, next_block, sizeof(block_of));
+    num_blocks = blocks;
+  } while (changed);
+
+  /* Number the states breadth first from the start state */
+  memset(state_of_block, -1, sizeof(state_of_block));
+  state_of_block[block_of[0]] = 0;
+  block_of_state[0] = block_of[0];
+  num_states = 1;
+  for (m = 0; m < num_states; m++) {
+    for (n = 0; n < num_trie_nodes && block_of[n] != block_of_state[m]; n++);
+    for (c = 0; c < 256; c++) {
+      int t = trie[n][c];
+
+      if (t >= 0 && state_of_block[block_of[t]] == -1) {
+        state_of_block[block_of[t]] = num_states;
+        block_of_state[num_states++] = block_of[t];
+      }
+    }
+  }
+
+  if (1 + num_states + num_finals > MAX_NAME_STATES) {
+    die("too many header name states");
+  }
+}
+
+/* header_state value reached over byte `c` from minimized state `s` */
+static int
+transition(int s, int c)
+{
+  int n, t;
+
+  for (n = 0; block_of[n] != block_of_state[s]; n++);
+  t = trie[n][c];
+  if (t == -1) {
+    return 0;                           /* h_general */
+  }
+  if (t < -1) {
+    return 1 + num_states + final_id(t);
+  }
+  return 1 + state_of_block[block_of[t]];
+}
+
+/* Bytes with the same column of transitions share a class, 0 is "other" */
+static void
+classify_bytes(void)
+{
+  int c, d, s;
+
+  for (s = 0; s < num_states; s++) {
+    for (c = 0; c < 256; c++) {
+      transitions[s][c] = transition(s, c);
+    }
+  }
+
+  num_classes = 1;
+  class_byte[0] = 0;
+  for (c = 0; c < 256; c++) {
+    for (s = 0; s < num_states && transitions[s][c] == 0; s++);
+    if (s == num_states) {
+      byte_class[c] = 0;
+      continue;
+    }
+    for (d = 0; d < c; d++) {
+      if (byte_class[d] == 0) {
+        continue;
+      }
+      for (s = 0; s < num_states && transitions[s][c] == transitions[s][d]; s++);
+      if (s == num_states) {
+        break;
+      }
+    }
+    if (d < c) {
+      byte_class[c] = byte_class[d];
+    } else {
+      class_byte[num_classes] = c;
+      byte_class[c] = num_classes++;
+    }
+  }
+}
+
+static void
+gen_header_name_states(void)
+{
+  int i;
+
+  build_trie();
+  for (i = 0; i < (int) NUM_HEADER_NAMES; i++) {
+    final_id(-2 - i);
+  }
+  minimize();
+  classify_bytes();
+
+  printf("  , h_name_first = h_general + 1\n"
+         "  , h_name_last = h_name_first + %d\n",
+         num_states - 1);
+  for (i = 0; i < num_finals; i++) {
+    printf("  , %s\n", finals[i]);
+  }
+}
+
+static void
+gen_header_names(void)
+{
+  unsigned long lengths = 0;
+  unsigned int i;
+  int s, c;
+
+  if (num_states == 0) {
+    die("header name states must be generated before the matcher");
+  }
+
+  for (i = 0; i < NUM_HEADER_NAMES; i++) {
+    size_t len = strlen(header_names[i].name);
+
+    if (len >= 32) {
+      die("header names must be shorter than 32 bytes");
+    }
+    lengths |= 1UL << len;
+  }
+
+  printf("/* Matcher for the header names the parser acts on, a minimal DFA over\n"
+         " * lowercased bytes. Its states are the header_states from h_name_first\n"
+         " * (nothing matched yet) to h_name_last. Each byte leads to another of\n"
+         " * them, to h_general once the name can't be one of those, or to the\n"
+         " * name's own header_state after its last byte.\n"
+         " */\n"
+         "#define HEADER_NAME_NEXT(state, c)                                     \\\n"
+         "  header_name_dfa[(state) - h_name_first]                              \\\n"
+         "                 [header_name_class[(unsigned char) (c)]]\n"
+         "\n"
+         "/* Bit n is set if one of the names is n bytes long */\n"
+         "#define HEADER_NAME_LENGTHS 0x%08lxUL\n"
+         "\n", lengths);
+  printf(
+         "static const uint8_t header_name_class[256] =\n");
+  for (c = 0; c < 256; c++) {
+    printf("%s%2d", c == 0 ? "  {" : c % 16 == 0 ? "\n  ," : ",",
+           byte_class[c]);
+  }
+  printf("\n  };\n"
+         "\n"
+         "/*                              ");
+  for (c = 1; c < num_classes; c++) {
+    printf("  %c", class_byte[c]);
+  }
+  printf(" */\n"
+         "static const uint8_t header_name_dfa[%d][%d] =\n", num_states,
+         num_classes);
+  for (s = 0; s < num_states; s++) {
+    printf("  %c /* h_name_first + %2d */ {", s == 0 ? '{' : ',', s);
+    for (c = 0; c < num_classes; c++) {
+      printf("%s%2d", c == 0 ? "" : ",", transitions[s][class_byte[c]]);
+    }
+    printf("}\n");
+  }
+  printf("  };\n");
+}
+
+
+/* Region rewriting */
+
+static const struct {
+  const char *name;
+  void (*gen)(void);
+} regions[] = {
+  { "char classes", gen_char_classes },
+  { "methods", gen_methods },
+  { "header name states", gen_header_name_states },
+  { "header names", gen_header_names },
+};
+
+#define BEGIN_MARK "/* BEGIN GENERATED "
+#define END_MARK "/* END GENERATED "
+
+static const char *
+region_name(const char *line, const char *mark, size_t *len)
+{
+  const char *s = strstr(line, mark);
+  const char *e;
+
+  if (s == NULL) {
+    return NULL;
+  }
+  s += strlen(mark);
+  e = strstr(s, " */");
+  if (e == NULL) {
+    die("unterminated region marker");
+  }
+  *len = (size_t) (e - s);
+  return s;
+}
+
+int
+main(void)
+{
+  char line[4096];
+  const char *name = NULL, *s;
+  size_t name_len = 0, len;
+  unsigned int i, done = 0;
+
+  while (fgets(line, sizeof(line), stdin) != NULL) {
+    if (name == NULL) {
+      fputs(line, stdout);
+      s = region_name(line, BEGIN_MARK, &len);
+      if (s == NULL) {
+        continue;
+      }
+      for (i = 0; i < sizeof(regions) / sizeof(regions[0]); i++) {
+        if (strlen(regions[i].name) == len &&
+            memcmp(regions[i].name, s, len) == 0) {
+          break;
+        }
+      }
+      if (i == sizeof(regions) / sizeof(regions[0])) {
+        die("unknown region");
+      }
+      regions[i].gen();
+      done++;
+      name = regions[i].name;
+      name_len = len;
+    } else {
+      s = region_name(line, END_MARK, &len);
+      if (s != NULL) {
+        if (len != name_len || memcmp(s, name, len) != 0) {
+          die("mismatched END GENERATED");
+        }
+        fputs(line, stdout);
+        name = NULL;
+      }
+    }
+  }
+
+  if (name != NULL) {
+    die("missing END GENERATED");
+  }
+  if (done != sizeof(regions) / sizeof(regions[0])) {
+    die("not every region was found");
+  }
+  return 0;
+}
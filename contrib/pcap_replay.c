@@ -0,0 +1,730 @@
+/* Copyright Joyent, Inc. and other Node contributors.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Replay the HTTP in a packet capture through the parser.
+ *
+ * Reads a classic pcap file (no libpcap needed), reassembles each TCP
+ * stream per direction and feeds it to its own parser with the original
+ * segment boundaries, in capture order. Reports throughput and the time
+ * each message took to parse: the time spent in the parser calls of its
+ * own stream, not the time until the rest of it was captured.
+ *
+ * The two directions of a connection are paired so that the response to
+ * a HEAD request is known to have no body. Only the first 64 requests
+ * waiting for a response are tracked.
+ *
+ * A stream that closes in the middle of a message counts as failed. Streams
+ * missing data from the capture are only parsed up to the gap and reported
+ * apart.
+ */
+
+#include "http_parser.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Link types */
+#define LINK_NULL       0
+#define LINK_ETHERNET   1
+#define LINK_RAW        101
+#define LINK_LINUX_SLL  113
+
+struct segment {
+  size_t stream;
+  const unsigned char *data;
+  size_t len;
+};
+
+/* Out-of-order data held until the gap before it fills */
+struct pending {
+  uint32_t seq;
+  const unsigned char *data;
+  size_t len;
+  struct pending *next;
+};
+
+struct stream {
+  unsigned char key[37];  /* family, addresses, ports */
+  int started;            /* next_seq is known */
+  int fin;
+  uint32_t next_seq;
+  struct pending *pending;
+  http_parser parser;
+  int done;               /* parse error or upgrade; ignore the rest */
+  size_t peer;            /* index + 1 of the other direction, or 0 */
+  uint64_t heads;         /* requests waiting for a response on this */
+  unsigned int nheads;    /* stream, a bit set for HEAD, oldest first */
+  int in_message;
+  uint64_t parse_ns;      /* parse time of the current message */
+  struct timespec mark;   /* start of the time not yet in parse_ns */
+};
+
+static struct stream *streams;
+static size_t nstreams;
+static size_t streams_size;
+
+static size_t *table;      /* open addressing, index + 1, 0 when free */
+static size_t table_size;
+
+static struct segment *segments;
+static size_t nsegments;
+static size_t segments_size;
+
+static uint64_t *latencies; /* ns per message */
+static size_t nlatencies;
+static size_t latencies_size;
+
+static void *
+grow (void *p, size_t *size, size_t elem)
+{
+  *size = *size ? 2 * *size : 1024;
+  p = realloc(p, *size * elem);
+  if (p == NULL) {
+    fprintf(stderr, "out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static uint16_t
+rd16be (const unsigned char *p)
+{
+  return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static uint32_t
+rd32be (const unsigned char *p)
+{
+  return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+         (uint32_t) p[2] << 8 | p[3];
+}
+
+static uint32_t
+rd32 (const unsigned char *p, int swap)
+{
+  uint32_t v;
+
+  memcpy(&v, p, 4);
+  if (swap) {
+    v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+  }
+  return v;
+}
+
+static size_t
+key_hash (const unsigned char *key)
+{
+  size_t h = 14695981039346656037ULL & (size_t) -1;
+  size_t i;
+
+  for (i = 0; i < 37; i++) {
+    h = (h ^ key[i]) * (size_t) 1099511628211ULL;
+  }
+  return h;
+}
+
+/* The index + 1 of the stream with `key`, or 0 */
+static size_t
+lookup_stream (const unsigned char *key)
+{
+  size_t i;
+
+  if (table_size == 0) {
+    return 0;
+  }
+  i = key_hash(key) & (table_size - 1);
+  while (table[i] != 0) {
+    if (memcmp(streams[table[i] - 1].key, key, 37) == 0) {
+      return table[i];
+    }
+    i = (i + 1) & (table_size - 1);
+  }
+  return 0;
+}
+
+/* Pair every stream with the other direction of its connection */
+static void
+pair_streams (void)
+{
+  unsigned char key[37];
+  size_t i;
+
+  for (i = 0; i < nstreams; i++) {
+    const unsigned char *k = streams[i].key;
+
+    key[0] = k[0];
+    memcpy(key + 1, k + 17, 16);
+    memcpy(key + 17, k + 1, 16);
+    memcpy(key + 33, k + 35, 2);
+    memcpy(key + 35, k + 33, 2);
+    streams[i].peer = lookup_stream(key);
+  }
+}
+
+static struct stream *
+find_stream (const unsigned char *key, size_t *index)
+{
+  size_t i;
+
+  if (2 * (nstreams + 1) > table_size) {
+    size_t old_size = table_size;
+    size_t *old = table;
+
+    table_size = table_size ? 2 * table_size : 1024;
+    table = calloc(table_size, sizeof(*table));
+    if (table == NULL) {
+      fprintf(stderr, "out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < old_size; i++) {
+      if (old[i] != 0) {
+        size_t j = key_hash(streams[old[i] - 1].key) & (table_size - 1);
+
+        while (table[j] != 0) j = (j + 1) & (table_size - 1);
+        table[j] = old[i];
+      }
+    }
+    free(old);
+  }
+
+  i = key_hash(key) & (table_size - 1);
+  while (table[i] != 0) {
+    if (memcmp(streams[table[i] - 1].key, key, 37) == 0) {
+      *index = table[i] - 1;
+      return &streams[*index];
+    }
+    i = (i + 1) & (table_size - 1);
+  }
+
+  if (nstreams == streams_size) {
+    streams = grow(streams, &streams_size, sizeof(*streams));
+  }
+  memset(&streams[nstreams], 0, sizeof(*streams));
+  memcpy(streams[nstreams].key, key, 37);
+  table[i] = nstreams + 1;
+  *index = nstreams;
+  return &streams[nstreams++];
+}
+
+static void
+add_segment (size_t stream, const unsigned char *data, size_t len)
+{
+  if (nsegments == segments_size) {
+    segments = grow(segments, &segments_size, sizeof(*segments));
+  }
+  segments[nsegments].stream = stream;
+  segments[nsegments].data = data;
+  segments[nsegments].len = len;
+  nsegments++;
+}
+
+/* Append what follows next_seq, dropping retransmitted bytes */
+static int
+deliver (struct stream *s, size_t index, uint32_t seq,
+         const unsigned char *data, size_t len)
+{
+  int32_t ahead = (int32_t) (seq - s->next_seq);
+
+  if (ahead > 0) {
+    return 0;
+  }
+  if ((size_t) -ahead >= len) {
+    return 1;  /* old data */
+  }
+  data += -ahead;
+  len -= -ahead;
+  add_segment(index, data, len);
+  s->next_seq += (uint32_t) len;
+  return 1;
+}
+
+static void
+tcp_segment (const unsigned char *key, uint32_t seq, int syn, int fin,
+             const unsigned char *data, size_t len)
+{
+  size_t index;
+  struct stream *s = find_stream(key, &index);
+
+  if (syn) {
+    if (!s->started) {
+      s->started = 1;
+      s->next_seq = seq + 1;
+    }
+    return;
+  }
+  if (fin) {
+    s->fin = 1;
+  }
+  if (len == 0) {
+    return;
+  }
+  if (!s->started) {
+    /* Capture began mid-stream; start here and let the parser decide */
+    s->started = 1;
+    s->next_seq = seq;
+  }
+
+  if (!deliver(s, index, seq, data, len)) {
+    struct pending *p = malloc(sizeof(*p));
+    struct pending **pp = &s->pending;
+
+    if (p == NULL) {
+      fprintf(stderr, "out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    p->seq = seq;
+    p->data = data;
+    p->len = len;
+    while (*pp != NULL && (int32_t) ((*pp)->seq - seq) < 0) {
+      pp = &(*pp)->next;
+    }
+    p->next = *pp;
+    *pp = p;
+    return;
+  }
+
+  while (s->pending != NULL) {
+    struct pending *p = s->pending;
+
+    if (!deliver(s, index, p->seq, p->data, p->len)) {
+      break;
+    }
+    s->pending = p->next;
+    free(p);
+  }
+}
+
+/* Network layer on: find TCP and hand its payload on */
+static void
+ip_packet (const unsigned char *p, size_t len)
+{
+  unsigned char key[37];
+  const unsigned char *tcp;
+  size_t tcp_len;
+  size_t hlen;
+
+  memset(key, 0, sizeof(key));
+  if (len >= 20 && (p[0] >> 4) == 4) {
+    size_t total = rd16be(p + 2);
+
+    hlen = (p[0] & 0x0f) * 4;
+    if (p[9] != 6 || hlen < 20 || total < hlen || total > len ||
+        (rd16be(p + 6) & 0x3fff) != 0) {
+      return;  /* not TCP, or a fragment */
+    }
+    key[0] = 4;
+    memcpy(key + 1, p + 12, 4);
+    memcpy(key + 17, p + 16, 4);
+    tcp = p + hlen;
+    tcp_len = total - hlen;
+  } else if (len >= 40 && (p[0] >> 4) == 6) {
+    size_t payload = rd16be(p + 4);
+
+    if (p[6] != 6 || 40 + payload > len) {
+      return;  /* not TCP right away */
+    }
+    key[0] = 6;
+    memcpy(key + 1, p + 8, 16);
+    memcpy(key + 17, p + 24, 16);
+    tcp = p + 40;
+    tcp_len = payload;
+  } else {
+    return;
+  }
+
+  if (tcp_len < 20) {
+    return;
+  }
+  hlen = (tcp[12] >> 4) * 4;
+  if (hlen < 20 || hlen > tcp_len) {
+    return;
+  }
+  memcpy(key + 33, tcp, 4);  /* source and destination ports */
+
+  /* SYN 0x02, FIN 0x01, RST 0x04 */
+  tcp_segment(key, rd32be(tcp + 4), tcp[13] & 0x02, tcp[13] & 0x05,
+              tcp + hlen, tcp_len - hlen);
+}
+
+static void
+link_packet (uint32_t link, const unsigned char *p, size_t len)
+{
+  uint16_t type;
+
+  switch (link) {
+    case LINK_ETHERNET:
+      if (len < 14) return;
+      type = rd16be(p + 12);
+      p += 14;
+      len -= 14;
+      while ((type == 0x8100 || type == 0x88a8) && len >= 4) {
+        type = rd16be(p + 2);
+        p += 4;
+        len -= 4;
+      }
+      if (type != 0x0800 && type != 0x86dd) return;
+      break;
+
+    case LINK_LINUX_SLL:
+      if (len < 16) return;
+      p += 16;
+      len -= 16;
+      break;
+
+    case LINK_NULL:
+      if (len < 4) return;
+      p += 4;
+      len -= 4;
+      break;
+
+    case LINK_RAW:
+      break;
+
+    default:
+      return;
+  }
+
+  ip_packet(p, len);
+}
+
+/* Split the capture into per-stream segments in order; returns 0 on
+ * success
+ */
+static int
+read_capture (const unsigned char *data, size_t len)
+{
+  const unsigned char *p = data + 24;
+  const unsigned char *end = data + len;
+  uint32_t magic;
+  uint32_t link;
+  int swap;
+
+  if (len < 24) {
+    fprintf(stderr, "not a pcap file\n");
+    return 1;
+  }
+
+  memcpy(&magic, data, 4);
+  if (magic == 0xa1b2c3d4 || magic == 0xa1b23c4d) {
+    swap = 0;
+  } else if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1) {
+    swap = 1;
+  } else {
+    fprintf(stderr, "not a classic pcap file (pcapng is not supported)\n");
+    return 1;
+  }
+  link = rd32(data + 20, swap) & 0x0fffffff;
+
+  while (end - p >= 16) {
+    size_t caplen = rd32(p + 8, swap);
+
+    p += 16;
+    if (caplen > (size_t) (end - p)) {
+      break;  /* truncated capture */
+    }
+    link_packet(link, p, caplen);
+    p += caplen;
+  }
+
+  return 0;
+}
+
+static uint64_t
+ns_since (const struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) (now.tv_sec - start->tv_sec) * 1000000000 +
+         (now.tv_nsec - start->tv_nsec);
+}
+
+/* Queue requests on the response stream; a response to HEAD has no body */
+static int
+on_headers_complete (http_parser *parser)
+{
+  struct stream *s = parser->data;
+  struct stream *peer;
+  int head;
+
+  if (parser->type == HTTP_REQUEST) {
+    if (s->peer != 0) {
+      peer = &streams[s->peer - 1];
+      if (peer->nheads < 64) {
+        peer->heads |= (uint64_t) (parser->method == HTTP_HEAD) <<
+                       peer->nheads++;
+      }
+    }
+    return 0;
+  }
+
+  if (parser->status_code / 100 == 1 || s->nheads == 0) {
+    return 0;  /* interim response, or its request wasn't seen */
+  }
+  head = (int) (s->heads & 1);
+  s->heads >>= 1;
+  s->nheads--;
+  return head;
+}
+
+static int
+on_message_begin (http_parser *parser)
+{
+  struct stream *s = parser->data;
+
+  s->in_message = 1;
+  s->parse_ns = 0;
+  clock_gettime(CLOCK_MONOTONIC, &s->mark);
+  return 0;
+}
+
+static int
+on_message_complete (http_parser *parser)
+{
+  struct stream *s = parser->data;
+
+  s->parse_ns += ns_since(&s->mark);
+  s->in_message = 0;
+  if (nlatencies == latencies_size) {
+    latencies = grow(latencies, &latencies_size, sizeof(*latencies));
+  }
+  latencies[nlatencies++] = s->parse_ns;
+  return 0;
+}
+
+/* http_parser_execute(), adding its time to the message in progress */
+static size_t
+timed_execute (struct stream *s, const http_parser_settings *settings,
+               const char *data, size_t len)
+{
+  size_t nparsed;
+
+  clock_gettime(CLOCK_MONOTONIC, &s->mark);
+  nparsed = http_parser_execute(&s->parser, settings, data, len);
+  if (s->in_message) {
+    s->parse_ns += ns_since(&s->mark);
+  }
+  return nparsed;
+}
+
+static double
+seconds_since (const struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double) (now.tv_sec - start->tv_sec) +
+         (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+/* Feed every segment to its stream's parser, timing messages if `timed`;
+ * returns the streams that failed to parse, ended in the middle of a
+ * message included, and sets `*gapped` to those cut short by a gap
+ */
+static size_t
+replay (const http_parser_settings *settings, int timed, size_t *gapped)
+{
+  size_t failed = 0;
+  size_t i;
+
+  *gapped = 0;
+
+  for (i = 0; i < nstreams; i++) {
+    streams[i].parser.data = &streams[i];
+    http_parser_init(&streams[i].parser, HTTP_BOTH);
+    streams[i].done = 0;
+    streams[i].heads = 0;
+    streams[i].nheads = 0;
+    streams[i].in_message = 0;
+  }
+
+  for (i = 0; i < nsegments; i++) {
+    struct stream *s = &streams[segments[i].stream];
+    size_t nparsed;
+
+    if (s->done) {
+      continue;
+    }
+    if (timed) {
+      nparsed = timed_execute(s, settings, (const char *) segments[i].data,
+                              segments[i].len);
+    } else {
+      nparsed = http_parser_execute(&s->parser, settings,
+                                    (const char *) segments[i].data,
+                                    segments[i].len);
+    }
+    if (s->parser.upgrade) {
+      s->done = 1;
+    } else if (nparsed != segments[i].len) {
+      s->done = 2;
+      failed++;
+    }
+  }
+
+  /* Bodies that end with the connection */
+  for (i = 0; i < nstreams; i++) {
+    struct stream *s = &streams[i];
+
+    if (s->done) {
+      continue;
+    }
+    if (s->pending != NULL) {
+      (*gapped)++;
+      continue;
+    }
+    if (s->fin) {
+      if (timed) {
+        timed_execute(s, settings, NULL, 0);
+      } else {
+        http_parser_execute(&s->parser, settings, NULL, 0);
+      }
+      if (HTTP_PARSER_ERRNO(&s->parser) != HPE_OK) {
+        failed++;
+      }
+    }
+  }
+
+  return failed;
+}
+
+static int
+compare_u64 (const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+static void
+usage (const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s $filename [$repeat]\n"
+          "  replays the HTTP streams of a classic pcap capture $repeat\n"
+          "  (default 10) times and reports parse throughput and latency;\n"
+          "  latency is the time spent parsing each message, responses\n"
+          "  to HEAD are told apart by pairing the two directions\n",
+          name);
+  exit(EXIT_FAILURE);
+}
+
+int
+main (int argc, char *argv[])
+{
+  http_parser_settings settings;
+  struct timespec start;
+  unsigned char *data;
+  FILE *file;
+  long file_length;
+  size_t bytes = 0;
+  size_t failed = 0;
+  size_t gapped;
+  size_t n;
+  size_t i;
+  int repeat = 10;
+  int r;
+  double elapsed;
+
+  if (argc < 2 || argc > 3) {
+    usage(argv[0]);
+  }
+  if (argc == 3 && (repeat = atoi(argv[2])) <= 0) {
+    usage(argv[0]);
+  }
+
+  file = fopen(argv[1], "rb");
+  if (file == NULL) {
+    perror("fopen");
+    return EXIT_FAILURE;
+  }
+  fseek(file, 0, SEEK_END);
+  file_length = ftell(file);
+  if (file_length == -1) {
+    perror("ftell");
+    return EXIT_FAILURE;
+  }
+  fseek(file, 0, SEEK_SET);
+
+  data = malloc(file_length > 0 ? file_length : 1);
+  if (data == NULL ||
+      fread(data, 1, file_length, file) != (size_t) file_length) {
+    fprintf(stderr, "couldn't read entire file\n");
+    return EXIT_FAILURE;
+  }
+  fclose(file);
+
+  if (read_capture(data, file_length) != 0) {
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < nsegments; i++) {
+    bytes += segments[i].len;
+  }
+  pair_streams();
+
+  /* Throughput, with only the callback that frames responses to HEAD */
+  http_parser_settings_init(&settings);
+  settings.on_headers_complete = on_headers_complete;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (r = 0; r < repeat; r++) {
+    n = replay(&settings, 0, &gapped);
+    if (r > 0 && n != failed) {
+      break;
+    }
+    failed = n;
+  }
+  elapsed = seconds_since(&start);
+
+  /* Latency, adding up the parse time of each message */
+  settings.on_message_begin = on_message_begin;
+  settings.on_message_complete = on_message_complete;
+  if (r == repeat) {
+    n = replay(&settings, 1, &gapped);
+  }
+  if (n != failed) {
+    fprintf(stderr, "replays disagree: %zu and %zu streams failed\n",
+            failed, n);
+    return EXIT_FAILURE;
+  }
+
+  printf("streams: %zu (%zu failed to parse, %zu cut short by a gap)\n",
+         nstreams, failed, gapped);
+  printf("segments: %zu | bytes: %zu | messages: %zu\n",
+         nsegments, bytes, nlatencies);
+  printf("throughput: %.2f mb/s | %.0f segments/sec\n",
+         (double) bytes * repeat / elapsed / (1024 * 1024),
+         (double) nsegments * repeat / elapsed);
+
+  if (nlatencies > 0) {
+    qsort(latencies, nlatencies, sizeof(*latencies), compare_u64);
+    printf("message latency (ns): p50 %llu | p90 %llu | p99 %llu | "
+           "max %llu\n",
+           (unsigned long long) latencies[nlatencies / 2],
+           (unsigned long long) latencies[nlatencies * 9 / 10],
+           (unsigned long long) latencies[nlatencies * 99 / 100],
+           (unsigned long long) latencies[nlatencies - 1]);
+  }
+
+  free(data);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,435 @@
+/* Copyright Joyent, Inc. and other Node contributors.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "pipeline.h"
+#include <pthread.h>
+#include <string.h>
+#include <strings.h>
+
+/* Jobs taken by a thread at a time */
+#define JOB_BATCH 16
+
+
+/* RFC 7230 tchar */
+static int
+is_token(char c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || strchr("!#$%&'*+-.^_`|~", c) != NULL;
+}
+
+/* The length of the header name before ':', or -1 if the name is empty or
+ * has anything but token bytes, whitespace before the ':' included. The
+ * parser may frame such a line differently, so the scan gives up on it.
+ */
+static int64_t
+header_name_len(const char *line, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len && line[i] != ':'; i++) {
+    if (line[i] == '\0' || !is_token(line[i])) {
+      return -1;
+    }
+  }
+  return i > 0 && i < len ? (int64_t) i : -1;
+}
+
+static int
+header_is(const char *line, size_t len, const char *name, size_t name_len)
+{
+  return len == name_len && strncasecmp(line, name, name_len) == 0;
+}
+
+static int
+is_ows(char c)
+{
+  return c == ' ' || c == '\t';
+}
+
+/* The Content-Length value in [p, end), or -1 if it isn't a plain number */
+static int64_t
+content_length(const char *p, const char *end)
+{
+  int64_t n = 0;
+  int digits = 0;
+
+  while (p < end && is_ows(*p)) p++;
+  while (p < end && *p >= '0' && *p <= '9') {
+    if (++digits > 18) {
+      return -1;
+    }
+    n = n * 10 + (*p++ - '0');
+  }
+  while (p < end && is_ows(*p)) p++;
+  return digits > 0 && p == end ? n : -1;
+}
+
+/* Whether the last coding of a Transfer-Encoding value is chunked */
+static int
+ends_chunked(const char *p, const char *end)
+{
+  while (end > p && is_ows(end[-1])) end--;
+  if (end - p < 7 || strncasecmp(end - 7, "chunked", 7) != 0) {
+    return 0;
+  }
+  end -= 7;
+  while (end > p && is_ows(end[-1])) end--;
+  return end == p || end[-1] == ',';
+}
+
+/* Whether a Connection value lists `token` */
+static int
+has_token(const char *p, const char *end, const char *token, size_t len)
+{
+  while (p < end) {
+    const char *q;
+    const char *next;
+
+    while (p < end && (is_ows(*p) || *p == ',')) p++;
+    for (next = p; next < end && *next != ','; next++);
+    for (q = next; q > p && is_ows(q[-1]); q--);
+    if ((size_t) (q - p) == len && strncasecmp(p, token, len) == 0) {
+      return 1;
+    }
+    p = next;
+  }
+  return 0;
+}
+
+/* http_pipeline_scan(), also telling whether the connection stays open
+ * after the request, as http_should_keep_alive() would
+ */
+static int
+scan_request(const char *data, size_t len, size_t *extent, int *keep_alive)
+{
+  const char *p = data;
+  const char *end = data + len;
+  const char *nl;
+  const char *eol;
+  int64_t length = -1;
+  int chunked = 0;
+  int te = 0;
+  int http_11;
+  int keep = 0;
+  int close = 0;
+
+  while (p < end && (*p == '\r' || *p == '\n')) p++;
+  if ((size_t) (end - p) >= 8 && memcmp(p, "CONNECT ", 8) == 0) {
+    return -1;
+  }
+
+  /* Request line */
+  nl = memchr(p, '\n', end - p);
+  if (nl == NULL) {
+    return 0;
+  }
+  eol = nl > p && nl[-1] == '\r' ? nl - 1 : nl;
+  if (eol - p < 8 || memcmp(eol - 8, "HTTP/", 5) != 0 ||
+      eol[-3] < '0' || eol[-3] > '9' || eol[-2] != '.' ||
+      eol[-1] < '0' || eol[-1] > '9') {
+    return -1;
+  }
+  http_11 = eol[-3] != '0' && eol[-1] != '0';
+  p = nl + 1;
+
+  for (;;) {
+    int64_t name_len;
+    size_t n;
+
+    nl = memchr(p, '\n', end - p);
+    if (nl == NULL) {
+      return 0;
+    }
+    eol = nl > p && nl[-1] == '\r' ? nl - 1 : nl;
+    n = eol - p;
+
+    if (n == 0) {
+      p = nl + 1;
+      break;
+    }
+
+    /* Folded lines start with whitespace and fail here too */
+    name_len = header_name_len(p, n);
+    if (name_len == -1) {
+      return -1;
+    }
+
+    switch (*p) {
+      case 'C':
+      case 'c':
+        if (header_is(p, name_len, "content-length", 14)) {
+          if (length != -1) {
+            return -1;
+          }
+          length = content_length(p + 15, eol);
+          if (length == -1) {
+            return -1;
+          }
+        } else if (header_is(p, name_len, "connection", 10)) {
+          keep |= has_token(p + 11, eol, "keep-alive", 10);
+          close |= has_token(p + 11, eol, "close", 5);
+        }
+        break;
+
+      case 'T':
+      case 't':
+        if (header_is(p, name_len, "transfer-encoding", 17)) {
+          if (te++) {
+            return -1;
+          }
+          chunked = ends_chunked(p + 18, eol);
+          if (!chunked) {
+            return -1;
+          }
+        }
+        break;
+
+      case 'U':
+      case 'u':
+        if (header_is(p, name_len, "upgrade", 7)) {
+          return -1;
+        }
+        break;
+    }
+
+    p = nl + 1;
+  }
+
+  if (chunked) {
+    if (length != -1) {
+      return -1;
+    }
+
+    for (;;) {
+      uint64_t size = 0;
+      int digits = 0;
+      const char *q;
+
+      nl = memchr(p, '\n', end - p);
+      if (nl == NULL) {
+        return 0;
+      }
+      for (q = p; q < nl; q++) {
+        int8_t v;
+        char c = *q;
+
+        if (c >= '0' && c <= '9') v = c - '0';
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') v = (c | 0x20) - 'a' + 10;
+        else break;
+
+        if (++digits > 15) {
+          return -1;
+        }
+        size = size * 16 + v;
+      }
+      if (digits == 0) {
+        return -1;
+      }
+      p = nl + 1;
+
+      if (size == 0) {
+        break;
+      }
+      if ((uint64_t) (end - p) < size + 2) {
+        return 0;
+      }
+      p += size;
+      if (p[0] != '\r' || p[1] != '\n') {
+        return -1;
+      }
+      p += 2;
+    }
+
+    /* Trailers up to the empty line */
+    for (;;) {
+      int empty;
+
+      nl = memchr(p, '\n', end - p);
+      if (nl == NULL) {
+        return 0;
+      }
+      empty = nl == p || (nl == p + 1 && *p == '\r');
+      p = nl + 1;
+      if (empty) {
+        break;
+      }
+    }
+  } else if (length > 0) {
+    if ((uint64_t) (end - p) < (uint64_t) length) {
+      return 0;
+    }
+    p += length;
+  }
+
+  *extent = p - data;
+  *keep_alive = http_11 ? !close : keep;
+  return 1;
+}
+
+int
+http_pipeline_scan(const char *data, size_t len, size_t *extent)
+{
+  int keep_alive;
+
+  return scan_request(data, len, extent, &keep_alive);
+}
+
+size_t
+http_pipeline_split(const char *data,
+                    size_t len,
+                    struct http_pipeline_job *jobs,
+                    size_t max_jobs,
+                    size_t *consumed)
+{
+  size_t off = 0;
+  size_t n;
+
+  for (n = 0; n < max_jobs; n++) {
+    size_t extent;
+    int keep_alive;
+
+    if (scan_request(data + off, len - off, &extent, &keep_alive) != 1) {
+      break;
+    }
+    jobs[n].data = data + off;
+    jobs[n].len = keep_alive ? extent : len - off;
+    jobs[n].tail = !keep_alive;
+    off += jobs[n].len;
+    if (jobs[n].tail) {
+      n++;
+      break;
+    }
+  }
+
+  *consumed = off;
+  return n;
+}
+
+
+struct pipeline_work {
+  struct http_pipeline_job *jobs;
+  size_t njobs;
+  const http_parser_settings *settings;
+  size_t next;
+  size_t failed;        /* lowest index of a job that is not ok */
+};
+
+static void
+parse_job(struct http_pipeline_job *job, const http_parser_settings *settings)
+{
+  http_parser *parser = &job->parser;
+  size_t nparsed;
+
+  http_parser_init(parser, HTTP_REQUEST);
+  nparsed = http_parser_execute_budget(parser, settings, job->data, job->len,
+                                       0, job->tail ? 0 : 1);
+
+  /* All of it must be one message, or the whole tail, and the connection
+   * must stay open after it unless it is the tail; EOF only passes between
+   * messages
+   */
+  job->ok = nparsed == job->len &&
+            HTTP_PARSER_ERRNO(parser) == HPE_OK &&
+            !parser->upgrade &&
+            (job->tail || http_should_keep_alive(parser)) &&
+            http_parser_execute(parser, settings, NULL, 0) == 0 &&
+            HTTP_PARSER_ERRNO(parser) == HPE_OK;
+}
+
+static void
+job_failed(struct pipeline_work *work, size_t i)
+{
+  size_t failed = work->failed;
+
+  while (i < failed &&
+         !__sync_bool_compare_and_swap(&work->failed, failed, i)) {
+    failed = work->failed;
+  }
+}
+
+static void *
+pipeline_worker(void *arg)
+{
+  struct pipeline_work *work = arg;
+  size_t i, last;
+
+  for (;;) {
+    i = __sync_fetch_and_add(&work->next, JOB_BATCH);
+    if (i >= work->njobs) {
+      break;
+    }
+    last = i + JOB_BATCH < work->njobs ? i + JOB_BATCH : work->njobs;
+    for (; i < last; i++) {
+      /* Jobs past a failed one are left to the serial parse */
+      if (i > __sync_fetch_and_add(&work->failed, 0)) {
+        work->jobs[i].ok = 0;
+        continue;
+      }
+      parse_job(&work->jobs[i], work->settings);
+      if (!work->jobs[i].ok) {
+        job_failed(work, i);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+size_t
+http_pipeline_parse(struct http_pipeline_job *jobs,
+                    size_t njobs,
+                    const http_parser_settings *settings,
+                    unsigned int nthreads)
+{
+  struct pipeline_work work;
+  pthread_t threads[64];
+  unsigned int nstarted = 0;
+  unsigned int i;
+  size_t n;
+
+  work.jobs = jobs;
+  work.njobs = njobs;
+  work.settings = settings;
+  work.next = 0;
+  work.failed = njobs;
+
+  if (nthreads > 64) {
+    nthreads = 64;
+  }
+  if (nthreads > 1 && njobs > JOB_BATCH) {
+    for (i = 1; i < nthreads; i++) {
+      if (pthread_create(&threads[nstarted], NULL, pipeline_worker,
+                         &work) != 0) {
+        break;
+      }
+      nstarted++;
+    }
+  }
+
+  pipeline_worker(&work);
+
+  for (i = 0; i < nstarted; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  for (n = 0; n < njobs && jobs[n].ok; n++);
+  return n;
+}
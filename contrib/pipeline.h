@@ -0,0 +1,87 @@
+/* Copyright Joyent, Inc. and other Node contributors.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Parallel parsing of pipelined requests.
+ *
+ * http_pipeline_split() finds where each request in a buffer ends from its
+ * Content-Length or by walking its chunks, without running the parser.
+ * http_pipeline_parse() then parses every request with its own
+ * http_parser on several threads. The jobs array keeps the order of the
+ * requests on the connection, so results are read back in sequence.
+ *
+ * The scan is only a guess: each request is parsed in full again, and a
+ * job that does not parse as exactly one complete message ends the
+ * parallel run. Parse from there on with a single parser as usual.
+ *
+ * A request that closes the connection (Connection: close, or HTTP/1.0
+ * without keep-alive) ends the split. Its job takes the rest of the data
+ * and parses it with one parser, as a serial parser would: with
+ * HTTP_PARSER_STRICT, anything but line breaks after it then fails.
+ *
+ * Jobs are handed out in order and none is started past a failed one,
+ * but with several threads jobs after it may already be running. Their
+ * callbacks must only record results per job (through parser.data); act
+ * on the results of the jobs before the index http_pipeline_parse()
+ * returns and throw the rest away.
+ */
+#ifndef http_pipeline_h
+#define http_pipeline_h
+
+#include "http_parser.h"
+
+struct http_pipeline_job {
+  const char *data;
+  size_t len;
+  http_parser parser;   /* set parser.data before http_pipeline_parse() */
+  int tail;             /* the rest of the data, from a closing request */
+  int ok;               /* parsed as exactly one complete request, or all
+                         * of the tail */
+};
+
+/* Find the end of the request at the start of `data`. Returns 1 and sets
+ * `*extent` when all of it is there, 0 when more data is needed and -1 when
+ * the framing can't be told without parsing: upgrades, CONNECT, obsolete
+ * line folding or conflicting lengths.
+ */
+int http_pipeline_scan(const char *data, size_t len, size_t *extent);
+
+/* Fill `jobs` with up to `max_jobs` complete requests from `data`, the
+ * last one a tail if a request closes the connection. Returns the number
+ * of jobs and sets `*consumed` to the bytes they cover.
+ */
+size_t http_pipeline_split(const char *data,
+                           size_t len,
+                           struct http_pipeline_job *jobs,
+                           size_t max_jobs,
+                           size_t *consumed);
+
+/* Parse `njobs` jobs on up to `nthreads` threads, the calling one included.
+ * Callbacks run on the worker threads, so they must only touch the state
+ * reachable from their own parser. Returns the number of leading jobs that
+ * are ok; the request at that index has to be parsed serially, and the
+ * results of the jobs from there on discarded.
+ */
+size_t http_pipeline_parse(struct http_pipeline_job *jobs,
+                           size_t njobs,
+                           const http_parser_settings *settings,
+                           unsigned int nthreads);
+
+#endif
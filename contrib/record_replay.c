@@ -0,0 +1,449 @@
+/* Copyright Joyent, Inc. and other Node contributors.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Replay a log written by http_recorder_execute() (contrib/recorder.h).
+ *
+ * Every connection gets its own parser and is fed the logged bytes with
+ * the logged call boundaries, in log order. A first pass checks that each
+ * call starts in the same state, consumes as much, ends with the same
+ * errno and runs the same callbacks on the same spans; further passes time
+ * the replay.
+ */
+
+#include "http_parser.h"
+#include "recorder.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct call {
+  uint32_t conn;
+  unsigned int mode;
+  unsigned int state;
+  unsigned int err;
+  size_t len;
+  size_t nparsed;
+  size_t nevents;
+  const unsigned char *events;
+  const char *data;
+};
+
+/* The call being replayed */
+static struct {
+  const struct call *call;
+  const unsigned char *ev;
+  size_t nevents;
+  const char *data;
+  int verify;
+  int mismatch;
+} cur;
+
+static int
+get_varint (const unsigned char **p, const unsigned char *end, uint64_t *v)
+{
+  int shift = 0;
+
+  *v = 0;
+  while (*p < end && shift < 64) {
+    unsigned char c = *(*p)++;
+
+    *v |= (uint64_t) (c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      return 0;
+    }
+    shift += 7;
+  }
+  return -1;
+}
+
+static int
+get_u8 (const unsigned char **p, const unsigned char *end, unsigned int *v)
+{
+  if (*p >= end) {
+    return -1;
+  }
+  *v = *(*p)++;
+  return 0;
+}
+
+/* Skip over one logged event, returning its kind and spans */
+static int
+get_event (const unsigned char **p, const unsigned char *end,
+           unsigned int *kind, uint64_t span[4], unsigned int *ret)
+{
+  int err = 0;
+
+  *ret = 0;
+  if (get_u8(p, end, kind) != 0) {
+    return -1;
+  }
+  switch (*kind) {
+    case HTTP_REC_HEADER:
+      err |= get_varint(p, end, &span[0]);
+      err |= get_varint(p, end, &span[1]);
+      err |= get_varint(p, end, &span[2]);
+      err |= get_varint(p, end, &span[3]);
+      break;
+
+    case HTTP_REC_URL:
+    case HTTP_REC_STATUS:
+    case HTTP_REC_HEADER_FIELD:
+    case HTTP_REC_HEADER_VALUE:
+    case HTTP_REC_BODY:
+      err |= get_varint(p, end, &span[0]);
+      err |= get_varint(p, end, &span[1]);
+      break;
+
+    case HTTP_REC_HEADERS_COMPLETE:
+      err |= get_u8(p, end, ret);
+      break;
+
+    default:
+      if (*kind >= HTTP_REC_MAX) {
+        return -1;
+      }
+      break;
+  }
+  return err;
+}
+
+/* Check a callback against the log and do what the logged one did */
+static int
+replay_event (http_parser *parser, enum http_rec_event kind,
+              const char *at0, size_t len0, const char *at1, size_t len1)
+{
+  uint64_t span[4] = { 0, 0, 0, 0 };
+  unsigned int logged;
+  unsigned int ret;
+  int last;
+
+  if (cur.nevents == cur.call->nevents) {
+    cur.mismatch = 1;
+    return 0;
+  }
+  /* The events of a call end where its data starts */
+  if (get_event(&cur.ev, (const unsigned char *) cur.data,
+                &logged, span, &ret) != 0) {
+    cur.mismatch = 1;
+    return 0;
+  }
+  last = ++cur.nevents == cur.call->nevents;
+
+  if (cur.verify) {
+    if (logged != (unsigned int) kind) {
+      cur.mismatch = 1;
+    } else if (at0 != NULL &&
+               (span[0] != (uint64_t) (at0 - cur.data) || span[1] != len0)) {
+      cur.mismatch = 1;
+    } else if (kind == HTTP_REC_HEADER &&
+               (span[0] != (uint64_t) (at0 - cur.data) || span[1] != len0 ||
+                span[2] != (uint64_t) (at1 - cur.data) || span[3] != len1)) {
+      cur.mismatch = 1;
+    }
+  }
+
+  if (last && cur.call->err == HPE_PAUSED) {
+    http_parser_pause(parser, 1);
+  } else if (last && cur.call->err != HPE_OK &&
+             strncmp(http_errno_name((enum http_errno) cur.call->err),
+                     "HPE_CB_", 7) == 0 &&
+             kind != HTTP_REC_HEADERS_COMPLETE) {
+    return 1;
+  }
+  return kind == HTTP_REC_HEADERS_COMPLETE ? (int) (signed char) ret : 0;
+}
+
+#define REPLAY_NOTIFY(FOR, KIND)                                     \
+static int                                                           \
+replay_##FOR (http_parser *parser)                                   \
+{                                                                    \
+  return replay_event(parser, KIND, NULL, 0, NULL, 0);               \
+}
+
+#define REPLAY_DATA(FOR, KIND)                                       \
+static int                                                           \
+replay_##FOR (http_parser *parser, const char *at, size_t len)       \
+{                                                                    \
+  return replay_event(parser, KIND, at, len, NULL, 0);               \
+}
+
+REPLAY_NOTIFY(on_message_begin, HTTP_REC_MESSAGE_BEGIN)
+REPLAY_DATA(on_url, HTTP_REC_URL)
+REPLAY_DATA(on_status, HTTP_REC_STATUS)
+REPLAY_DATA(on_header_field, HTTP_REC_HEADER_FIELD)
+REPLAY_DATA(on_header_value, HTTP_REC_HEADER_VALUE)
+REPLAY_NOTIFY(on_headers_complete, HTTP_REC_HEADERS_COMPLETE)
+REPLAY_DATA(on_body, HTTP_REC_BODY)
+REPLAY_NOTIFY(on_message_complete, HTTP_REC_MESSAGE_COMPLETE)
+REPLAY_NOTIFY(on_chunk_header, HTTP_REC_CHUNK_HEADER)
+REPLAY_NOTIFY(on_chunk_complete, HTTP_REC_CHUNK_COMPLETE)
+REPLAY_NOTIFY(on_request_line_complete, HTTP_REC_REQUEST_LINE_COMPLETE)
+REPLAY_NOTIFY(on_status_line_complete, HTTP_REC_STATUS_LINE_COMPLETE)
+
+static int
+replay_on_header (http_parser *parser,
+                  const char *field, size_t field_len,
+                  const char *value, size_t value_len)
+{
+  return replay_event(parser, HTTP_REC_HEADER,
+                      field, field_len, value, value_len);
+}
+
+/* Split the log into calls; returns the number or -1 */
+static long
+read_log (const unsigned char *p, const unsigned char *end,
+          struct call **calls_out, uint32_t *nconns)
+{
+  struct call *calls = NULL;
+  size_t ncalls = 0;
+  size_t size = 0;
+
+  *nconns = 0;
+  while (p < end) {
+    struct call c;
+    uint64_t v;
+    uint64_t len;
+    uint64_t nparsed;
+    uint64_t nevents;
+    uint64_t i;
+    int err = 0;
+
+    err |= get_varint(&p, end, &v);
+    err |= get_u8(&p, end, &c.mode);
+    err |= get_u8(&p, end, &c.state);
+    err |= get_varint(&p, end, &len);
+    err |= get_varint(&p, end, &nparsed);
+    err |= get_u8(&p, end, &c.err);
+    err |= get_varint(&p, end, &nevents);
+    if (err || v > UINT32_MAX) {
+      return -1;
+    }
+
+    c.conn = (uint32_t) v;
+    c.len = (size_t) len;
+    c.nparsed = (size_t) nparsed;
+    c.nevents = (size_t) nevents;
+    c.events = p;
+    for (i = 0; i < nevents; i++) {
+      uint64_t span[4];
+      unsigned int kind;
+      unsigned int ret;
+
+      if (get_event(&p, end, &kind, span, &ret) != 0) {
+        return -1;
+      }
+    }
+    if ((uint64_t) (end - p) < len) {
+      return -1;
+    }
+    c.data = (const char *) p;
+    p += len;
+
+    if (ncalls == size) {
+      size = size ? 2 * size : 1024;
+      calls = realloc(calls, size * sizeof(*calls));
+      if (calls == NULL) {
+        return -1;
+      }
+    }
+    calls[ncalls++] = c;
+    if (c.conn >= *nconns) {
+      *nconns = c.conn + 1;
+    }
+  }
+
+  *calls_out = calls;
+  return (long) ncalls;
+}
+
+/* Replay all calls; returns how many of them didn't match the log */
+static size_t
+replay (const struct call *calls, size_t ncalls,
+        http_parser *parsers, unsigned char *started, uint32_t nconns,
+        int verify)
+{
+  http_parser_settings settings;
+  http_parser_settings settings_on_header;
+  size_t mismatches = 0;
+  size_t i;
+
+  memset(&settings, 0, sizeof(settings));
+  settings.on_message_begin = replay_on_message_begin;
+  settings.on_url = replay_on_url;
+  settings.on_status = replay_on_status;
+  settings.on_header_field = replay_on_header_field;
+  settings.on_header_value = replay_on_header_value;
+  settings.on_headers_complete = replay_on_headers_complete;
+  settings.on_body = replay_on_body;
+  settings.on_message_complete = replay_on_message_complete;
+  settings.on_chunk_header = replay_on_chunk_header;
+  settings.on_chunk_complete = replay_on_chunk_complete;
+  settings.on_request_line_complete = replay_on_request_line_complete;
+  settings.on_status_line_complete = replay_on_status_line_complete;
+  settings_on_header = settings;
+  settings_on_header.on_header = replay_on_header;
+
+  memset(started, 0, nconns);
+  cur.verify = verify;
+
+  for (i = 0; i < ncalls; i++) {
+    const struct call *c = &calls[i];
+    http_parser *parser = &parsers[c->conn];
+    size_t nparsed;
+
+    if (!started[c->conn]) {
+      http_parser_init(parser, (enum http_parser_type) (c->mode & 3));
+      started[c->conn] = 1;
+    } else if (HTTP_PARSER_ERRNO(parser) == HPE_PAUSED) {
+      http_parser_pause(parser, 0);
+    }
+
+    cur.call = c;
+    cur.ev = c->events;
+    cur.nevents = 0;
+    cur.data = c->data;
+    cur.mismatch = verify && parser->state != c->state;
+
+    nparsed = http_parser_execute(parser,
+                                  c->mode & HTTP_RECORDER_ON_HEADER ?
+                                    &settings_on_header : &settings,
+                                  c->len > 0 ? c->data : NULL,
+                                  c->len);
+
+    if (verify &&
+        (cur.mismatch || nparsed != c->nparsed ||
+         HTTP_PARSER_ERRNO(parser) != c->err || cur.nevents != c->nevents)) {
+      mismatches++;
+    }
+  }
+
+  return mismatches;
+}
+
+static void
+usage (const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s $logfile [$repeat]\n"
+          "  checks a log written by http_recorder_execute() against the\n"
+          "  parser and times $repeat (default 10) replays of it\n",
+          name);
+  exit(EXIT_FAILURE);
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct timespec start;
+  struct timespec end;
+  struct call *calls;
+  http_parser *parsers;
+  unsigned char *started;
+  unsigned char *log;
+  FILE *file;
+  long file_length;
+  long ncalls;
+  uint32_t nconns;
+  size_t bytes = 0;
+  size_t mismatches;
+  size_t i;
+  int repeat = 10;
+  int r;
+  double elapsed;
+
+  if (argc < 2 || argc > 3) {
+    usage(argv[0]);
+  }
+  if (argc == 3 && (repeat = atoi(argv[2])) <= 0) {
+    usage(argv[0]);
+  }
+
+  file = fopen(argv[1], "rb");
+  if (file == NULL) {
+    perror("fopen");
+    return EXIT_FAILURE;
+  }
+  fseek(file, 0, SEEK_END);
+  file_length = ftell(file);
+  if (file_length == -1) {
+    perror("ftell");
+    return EXIT_FAILURE;
+  }
+  fseek(file, 0, SEEK_SET);
+
+  log = malloc(file_length > 0 ? file_length : 1);
+  if (log == NULL ||
+      fread(log, 1, file_length, file) != (size_t) file_length) {
+    fprintf(stderr, "couldn't read entire file\n");
+    return EXIT_FAILURE;
+  }
+  fclose(file);
+
+  if ((size_t) file_length < sizeof(HTTP_RECORDER_MAGIC) ||
+      memcmp(log, HTTP_RECORDER_MAGIC, sizeof(HTTP_RECORDER_MAGIC) - 1) != 0) {
+    fprintf(stderr, "not a recorder log\n");
+    return EXIT_FAILURE;
+  }
+
+  ncalls = read_log(log + sizeof(HTTP_RECORDER_MAGIC),
+                    log + file_length, &calls, &nconns);
+  if (ncalls < 0) {
+    fprintf(stderr, "corrupt log\n");
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < (size_t) ncalls; i++) {
+    bytes += calls[i].len;
+  }
+
+  parsers = calloc(nconns ? nconns : 1, sizeof(*parsers));
+  started = malloc(nconns ? nconns : 1);
+  if (parsers == NULL || started == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return EXIT_FAILURE;
+  }
+
+  mismatches = replay(calls, ncalls, parsers, started, nconns, 1);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (r = 0; r < repeat; r++) {
+    replay(calls, ncalls, parsers, started, nconns, 0);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  elapsed = (double) (end.tv_sec - start.tv_sec) +
+            (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+  printf("%s log: %ld calls | %u connections | %zu bytes\n",
+         log[sizeof(HTTP_RECORDER_MAGIC) - 1] & HTTP_RECORDER_REDACT ?
+           "redacted" : "raw",
+         ncalls, nconns, bytes);
+  printf("calls not matching the log: %zu\n", mismatches);
+  printf("replay: %.2f mb/s | %.0f calls/sec\n",
+         (double) bytes * repeat / elapsed / (1024 * 1024),
+         (double) ncalls * repeat / elapsed);
+
+  free(parsers);
+  free(started);
+  free(calls);
+  free(log);
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
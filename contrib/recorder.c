@@ -0,0 +1,470 @@
+/* Copyright Joyent, Inc. and other Node contributors.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "recorder.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct rec_event {
+  unsigned char kind;
+  unsigned char ret;
+  unsigned char keep;       /* bit i: span i is logged as it is */
+  size_t off[2];
+  size_t len[2];
+};
+
+struct http_recorder {
+  FILE *file;
+  unsigned int flags;
+  uint32_t next_id;
+
+  /* The call being recorded */
+  http_parser_settings user;
+  struct http_recorder_conn *conn;
+  const char *data;
+  size_t len;
+  char *copy;               /* redacted data */
+  size_t copy_size;
+  struct rec_event *events;
+  size_t nevents;
+  size_t events_size;
+};
+
+/* Callbacks only get the parser, whose data belongs to the caller */
+static __thread struct http_recorder *current;
+
+static struct rec_event *
+add_event (struct http_recorder *rec, enum http_rec_event kind)
+{
+  struct rec_event *e;
+
+  if (rec->nevents == rec->events_size) {
+    size_t size = rec->events_size ? 2 * rec->events_size : 64;
+    struct rec_event *events = realloc(rec->events, size * sizeof(*events));
+
+    if (events == NULL) {
+      abort();
+    }
+    rec->events = events;
+    rec->events_size = size;
+  }
+
+  e = &rec->events[rec->nevents++];
+  memset(e, 0, sizeof(*e));
+  e->kind = (unsigned char) kind;
+  return e;
+}
+
+static size_t
+offset (const struct http_recorder *rec, const char *at, size_t len)
+{
+  assert(at >= rec->data && at + len <= rec->data + rec->len);
+  return (size_t) (at - rec->data);
+}
+
+static void
+redact (struct http_recorder *rec, size_t off, size_t len)
+{
+  char *p = rec->copy + off;
+  char *end = p + len;
+
+  for (; p < end; p++) {
+    unsigned char c = (unsigned char) *p;
+
+    if (c >= 'a' && c <= 'z') *p = 'a';
+    else if (c >= 'A' && c <= 'Z') *p = 'A';
+    else if (c >= '0' && c <= '9') *p = '0';
+    else if (c >= 0x80) *p = (char) 0x80;
+  }
+}
+
+/* Whether the value of the current header decides the framing */
+static int
+framing_header (const struct http_recorder_conn *conn)
+{
+  static const char *const names[] =
+    { "content-length", "transfer-encoding", "connection", "upgrade" };
+  size_t i;
+
+  for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (conn->field_len == strlen(names[i]) &&
+        memcmp(conn->field, names[i], conn->field_len) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void
+field_append (struct http_recorder_conn *conn, const char *at, size_t len)
+{
+  size_t i;
+
+  if (conn->in_value) {
+    conn->field_len = 0;
+    conn->in_value = 0;
+  }
+  for (i = 0; i < len && conn->field_len != 0xff; i++) {
+    if (conn->field_len == sizeof(conn->field)) {
+      conn->field_len = 0xff;
+      break;
+    }
+    conn->field[conn->field_len++] = (char) (at[i] | 0x20);
+  }
+}
+
+#define REC_NOTIFY(FOR, KIND)                                        \
+static int                                                           \
+rec_##FOR (http_parser *parser)                                      \
+{                                                                    \
+  struct http_recorder *rec = current;                               \
+                                                                     \
+  add_event(rec, KIND);                                              \
+  return rec->user.FOR ? rec->user.FOR(parser) : 0;                  \
+}
+
+#define REC_DATA(FOR, KIND)                                          \
+static int                                                           \
+rec_##FOR (http_parser *parser, const char *at, size_t len)          \
+{                                                                    \
+  struct http_recorder *rec = current;                               \
+  struct rec_event *e = add_event(rec, KIND);                        \
+                                                                     \
+  e->off[0] = offset(rec, at, len);                                  \
+  e->len[0] = len;                                                   \
+  return rec->user.FOR ? rec->user.FOR(parser, at, len) : 0;         \
+}
+
+REC_NOTIFY(on_message_begin, HTTP_REC_MESSAGE_BEGIN)
+REC_DATA(on_url, HTTP_REC_URL)
+REC_DATA(on_status, HTTP_REC_STATUS)
+REC_DATA(on_body, HTTP_REC_BODY)
+REC_NOTIFY(on_message_complete, HTTP_REC_MESSAGE_COMPLETE)
+REC_NOTIFY(on_chunk_header, HTTP_REC_CHUNK_HEADER)
+REC_NOTIFY(on_chunk_complete, HTTP_REC_CHUNK_COMPLETE)
+REC_NOTIFY(on_request_line_complete, HTTP_REC_REQUEST_LINE_COMPLETE)
+REC_NOTIFY(on_status_line_complete, HTTP_REC_STATUS_LINE_COMPLETE)
+
+static int
+rec_on_header_field (http_parser *parser, const char *at, size_t len)
+{
+  struct http_recorder *rec = current;
+  struct rec_event *e = add_event(rec, HTTP_REC_HEADER_FIELD);
+
+  e->off[0] = offset(rec, at, len);
+  e->len[0] = len;
+  e->keep = 1;
+  field_append(rec->conn, at, len);
+  return rec->user.on_header_field ?
+         rec->user.on_header_field(parser, at, len) : 0;
+}
+
+static int
+rec_on_header_value (http_parser *parser, const char *at, size_t len)
+{
+  struct http_recorder *rec = current;
+  struct rec_event *e = add_event(rec, HTTP_REC_HEADER_VALUE);
+
+  e->off[0] = offset(rec, at, len);
+  e->len[0] = len;
+  rec->conn->in_value = 1;
+  if (framing_header(rec->conn)) {
+    e->keep = 1;
+  }
+  return rec->user.on_header_value ?
+         rec->user.on_header_value(parser, at, len) : 0;
+}
+
+static int
+rec_on_headers_complete (http_parser *parser)
+{
+  struct http_recorder *rec = current;
+  struct rec_event *e = add_event(rec, HTTP_REC_HEADERS_COMPLETE);
+  int ret = rec->user.on_headers_complete ?
+            rec->user.on_headers_complete(parser) : 0;
+
+  e->ret = (unsigned char) ret;
+  return ret;
+}
+
+/* Sees every header line, the caller's filter is applied here */
+static int
+rec_on_header (http_parser *parser,
+               const char *field, size_t field_len,
+               const char *value, size_t value_len)
+{
+  struct http_recorder *rec = current;
+  struct rec_event *e = add_event(rec, HTTP_REC_HEADER);
+
+  e->off[0] = offset(rec, field, field_len);
+  e->len[0] = field_len;
+  e->off[1] = offset(rec, value, value_len);
+  e->len[1] = value_len;
+
+  rec->conn->in_value = 1;
+  field_append(rec->conn, field, field_len);
+  e->keep = framing_header(rec->conn) ? 3 : 1;
+  rec->conn->in_value = 1;
+
+  if (rec->user.header_filter != NULL &&
+      !http_header_filter_match(rec->user.header_filter, field, field_len)) {
+    return 0;
+  }
+  return rec->user.on_header(parser, field, field_len, value, value_len);
+}
+
+/* Put back the framing between spans in [from, to): the request or status
+ * line around the URL and status text, line breaks, the separators of
+ * header lines and chunk sizes. Chunk extensions stay redacted.
+ */
+static void
+restore_framing (struct http_recorder *rec, size_t from, size_t to)
+{
+  struct http_recorder_conn *conn = rec->conn;
+  size_t i;
+
+  for (i = from; i < to; i++) {
+    char c = rec->data[i];
+
+    if (conn->in_ext) {
+      if (c != '\r' && c != '\n') {
+        continue;
+      }
+      conn->in_ext = 0;
+    } else if (c == ';') {
+      conn->in_ext = 1;
+    }
+    rec->copy[i] = c;
+  }
+}
+
+/* Redact the whole call, then put back what the parser framed it with.
+ * Bytes are only put back if the parser reported the span they are in
+ * or passed them as framing: after a parse error, everything from the
+ * end of the last reported span may belong to a span that never reached
+ * its callback, and the bytes not consumed are passed again later.
+ */
+static void
+redact_call (struct http_recorder *rec, const http_parser *parser,
+             size_t nparsed)
+{
+  enum http_errno err = HTTP_PARSER_ERRNO(parser);
+  size_t pos = 0;
+  size_t i;
+  int j;
+
+  redact(rec, 0, rec->len);
+
+  for (i = 0; i < rec->nevents; i++) {
+    const struct rec_event *e = &rec->events[i];
+    int nspans;
+
+    switch (e->kind) {
+      case HTTP_REC_HEADER:
+        nspans = 2;
+        break;
+
+      case HTTP_REC_URL:
+      case HTTP_REC_STATUS:
+      case HTTP_REC_HEADER_FIELD:
+      case HTTP_REC_HEADER_VALUE:
+      case HTTP_REC_BODY:
+        nspans = 1;
+        break;
+
+      default:
+        continue;
+    }
+
+    for (j = 0; j < nspans; j++) {
+      restore_framing(rec, pos, e->off[j]);
+      rec->conn->in_ext = 0;
+      if (e->keep & (1 << j)) {
+        memcpy(rec->copy + e->off[j], rec->data + e->off[j], e->len[j]);
+      }
+      pos = e->off[j] + e->len[j];
+    }
+  }
+
+  if (err == HPE_OK || err == HPE_PAUSED ||
+      strncmp(http_errno_name(err), "HPE_CB_", 7) == 0) {
+    restore_framing(rec, pos, nparsed);
+  }
+}
+
+static void
+put_varint (FILE *file, uint64_t v)
+{
+  while (v >= 0x80) {
+    putc((int) (v & 0x7f) | 0x80, file);
+    v >>= 7;
+  }
+  putc((int) v, file);
+}
+
+struct http_recorder *
+http_recorder_open (const char *path, unsigned int flags)
+{
+  struct http_recorder *rec = calloc(1, sizeof(*rec));
+
+  if (rec == NULL) {
+    return NULL;
+  }
+
+  rec->file = fopen(path, "wb");
+  if (rec->file == NULL) {
+    free(rec);
+    return NULL;
+  }
+  rec->flags = flags;
+
+  fwrite(HTTP_RECORDER_MAGIC, 1, sizeof(HTTP_RECORDER_MAGIC) - 1, rec->file);
+  putc((int) flags, rec->file);
+  return rec;
+}
+
+int
+http_recorder_close (struct http_recorder *rec)
+{
+  int err = ferror(rec->file);
+
+  err |= fclose(rec->file);
+  free(rec->copy);
+  free(rec->events);
+  free(rec);
+  return err != 0;
+}
+
+void
+http_recorder_conn_init (struct http_recorder *rec,
+                         struct http_recorder_conn *conn)
+{
+  memset(conn, 0, sizeof(*conn));
+  conn->id = rec->next_id++;
+  conn->in_value = 1;
+}
+
+size_t
+http_recorder_execute (struct http_recorder *rec,
+                       struct http_recorder_conn *conn,
+                       http_parser *parser,
+                       const http_parser_settings *settings,
+                       const char *data,
+                       size_t len)
+{
+  struct http_recorder *saved = current;
+  http_parser_settings wrapped;
+  unsigned int state = parser->state;
+  unsigned int mode = parser->type;
+  size_t nparsed;
+  size_t i;
+
+  if (rec->flags & HTTP_RECORDER_REDACT) {
+    if (len > rec->copy_size) {
+      char *copy = realloc(rec->copy, len);
+
+      if (copy == NULL) {
+        abort();
+      }
+      rec->copy = copy;
+      rec->copy_size = len;
+    }
+    if (len > 0) {
+      memcpy(rec->copy, data, len);
+    }
+  }
+
+  memset(&wrapped, 0, sizeof(wrapped));
+  wrapped.on_message_begin = rec_on_message_begin;
+  wrapped.on_url = rec_on_url;
+  wrapped.on_status = rec_on_status;
+  wrapped.on_header_field = rec_on_header_field;
+  wrapped.on_header_value = rec_on_header_value;
+  wrapped.on_headers_complete = rec_on_headers_complete;
+  wrapped.on_body = rec_on_body;
+  wrapped.on_message_complete = rec_on_message_complete;
+  wrapped.on_chunk_header = rec_on_chunk_header;
+  wrapped.on_chunk_complete = rec_on_chunk_complete;
+  wrapped.on_request_line_complete = rec_on_request_line_complete;
+  wrapped.on_status_line_complete = rec_on_status_line_complete;
+  if (settings->on_header != NULL) {
+    /* on_header changes how the parser works, only wrap it when set */
+    wrapped.on_header = rec_on_header;
+    mode |= HTTP_RECORDER_ON_HEADER;
+  }
+
+  rec->user = *settings;
+  rec->conn = conn;
+  rec->data = data;
+  rec->len = len;
+  rec->nevents = 0;
+
+  current = rec;
+  nparsed = http_parser_execute(parser, &wrapped, data, len);
+  current = saved;
+
+  if (rec->flags & HTTP_RECORDER_REDACT) {
+    redact_call(rec, parser, nparsed);
+  }
+
+  put_varint(rec->file, conn->id);
+  putc((int) mode, rec->file);
+  putc((int) state, rec->file);
+  put_varint(rec->file, len);
+  put_varint(rec->file, nparsed);
+  putc((int) HTTP_PARSER_ERRNO(parser), rec->file);
+  put_varint(rec->file, rec->nevents);
+  for (i = 0; i < rec->nevents; i++) {
+    const struct rec_event *e = &rec->events[i];
+
+    putc(e->kind, rec->file);
+    switch (e->kind) {
+      case HTTP_REC_HEADER:
+        put_varint(rec->file, e->off[0]);
+        put_varint(rec->file, e->len[0]);
+        put_varint(rec->file, e->off[1]);
+        put_varint(rec->file, e->len[1]);
+        break;
+
+      case HTTP_REC_URL:
+      case HTTP_REC_STATUS:
+      case HTTP_REC_HEADER_FIELD:
+      case HTTP_REC_HEADER_VALUE:
+      case HTTP_REC_BODY:
+        put_varint(rec->file, e->off[0]);
+        put_varint(rec->file, e->len[0]);
+        break;
+
+      case HTTP_REC_HEADERS_COMPLETE:
+        putc(e->ret, rec->file);
+        break;
+
+      default:
+        break;
+    }
+  }
+  if (len > 0) {
+    fwrite(rec->flags & HTTP_RECORDER_REDACT ? rec->copy : data, 1, len,
+           rec->file);
+  }
+
+  return nparsed;
+}
@@ -0,0 +1,111 @@
+/* Copyright Joyent, Inc. and other Node contributors.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Parse-call recorder.
+ *
+ * http_recorder_execute() wraps http_parser_execute() and logs each call:
+ * the connection, the parser state it started in, the bytes passed and
+ * consumed, the errno and the callbacks run with their spans. With
+ * HTTP_RECORDER_REDACT the logged bytes are reduced to character classes
+ * (letters to 'a'/'A', digits to '0', other bytes above 0x7f to 0x80), so
+ * only the shape of the traffic leaves the host. Only what decides the
+ * framing is put back as it was: method, version, status code, header
+ * names, chunk sizes, line breaks and separators, and the values of
+ * Content-Length, Transfer-Encoding, Connection and Upgrade. URLs, status
+ * texts, other header values, bodies and chunk extensions stay redacted,
+ * and so does everything after the last complete span when the parser
+ * fails, since the span it failed in never reached a callback. Replaying
+ * such a call may then fail at another byte.
+ *
+ * contrib/record_replay.c feeds a log back through the parser with the
+ * same call boundaries and checks the results match.
+ *
+ * A recorder is not thread-safe; use one per thread.
+ */
+#ifndef http_recorder_h
+#define http_recorder_h
+
+#include "http_parser.h"
+#include <stdio.h>
+
+/* Log file layout. All integers are unsigned LEB128 varints.
+ *
+ *   "HPREC1" flags:u8
+ *   then per call:
+ *     conn mode:u8 state:u8 len nparsed errno:u8 nevents
+ *     nevents * (kind:u8 [offset length] [offset length] [ret:u8])
+ *     len bytes of data
+ *
+ * `mode` is the parser type, plus HTTP_RECORDER_ON_HEADER if the settings
+ * had on_header. Data events have one span, HTTP_REC_HEADER has two (field,
+ * value) and notifications none; HTTP_REC_HEADERS_COMPLETE also keeps what
+ * the callback returned. Offsets are from the start of the call's data.
+ */
+#define HTTP_RECORDER_MAGIC "HPREC1"
+#define HTTP_RECORDER_REDACT 1
+#define HTTP_RECORDER_ON_HEADER 0x80
+
+enum http_rec_event
+  { HTTP_REC_MESSAGE_BEGIN
+  , HTTP_REC_URL
+  , HTTP_REC_STATUS
+  , HTTP_REC_HEADER_FIELD
+  , HTTP_REC_HEADER_VALUE
+  , HTTP_REC_HEADERS_COMPLETE
+  , HTTP_REC_BODY
+  , HTTP_REC_MESSAGE_COMPLETE
+  , HTTP_REC_CHUNK_HEADER
+  , HTTP_REC_CHUNK_COMPLETE
+  , HTTP_REC_REQUEST_LINE_COMPLETE
+  , HTTP_REC_STATUS_LINE_COMPLETE
+  , HTTP_REC_HEADER
+  , HTTP_REC_MAX
+  };
+
+struct http_recorder;
+
+/* Per connection state; set up with http_recorder_conn_init() */
+struct http_recorder_conn {
+  uint32_t id;
+  unsigned char field_len;  /* of the current header name, 0xff if long */
+  unsigned char in_value;   /* the header name is complete */
+  unsigned char in_ext;     /* in a chunk extension */
+  char field[20];           /* lower case */
+};
+
+/* Create the log at `path`; NULL and errno on failure */
+struct http_recorder *http_recorder_open(const char *path, unsigned int flags);
+
+/* Flush and close; returns nonzero if writing the log failed */
+int http_recorder_close(struct http_recorder *rec);
+
+void http_recorder_conn_init(struct http_recorder *rec,
+                             struct http_recorder_conn *conn);
+
+/* http_parser_execute() that logs the call */
+size_t http_recorder_execute(struct http_recorder *rec,
+                             struct http_recorder_conn *conn,
+                             http_parser *parser,
+                             const http_parser_settings *settings,
+                             const char *data,
+                             size_t len);
+
+#endif
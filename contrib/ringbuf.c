@@ -0,0 +1,177 @@
+/* Copyright Joyent, Inc. and other Node contributors.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE /* memfd_create */
+#endif
+
+#include "ringbuf.h"
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+int
+http_ringbuf_init(struct http_ringbuf *rb, size_t size)
+{
+  size_t page = (size_t) sysconf(_SC_PAGESIZE);
+  char *base;
+  int fd;
+  int err;
+
+  size = (size + page - 1) / page * page;
+  if (size == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  fd = memfd_create("http_ringbuf", MFD_CLOEXEC);
+  if (fd == -1) {
+    return -1;
+  }
+
+  if (ftruncate(fd, (off_t) size) == -1) {
+    goto fail_fd;
+  }
+
+  /* Reserve both halves at once, then map the file over each of them */
+  base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    goto fail_fd;
+  }
+
+  if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+           fd, 0) == MAP_FAILED ||
+      mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+           fd, 0) == MAP_FAILED) {
+    err = errno;
+    munmap(base, 2 * size);
+    close(fd);
+    errno = err;
+    return -1;
+  }
+
+  /* The mappings keep the memory alive */
+  close(fd);
+
+  rb->base = base;
+  rb->size = size;
+  rb->head = 0;
+  rb->len = 0;
+  return 0;
+
+fail_fd:
+  err = errno;
+  close(fd);
+  errno = err;
+  return -1;
+}
+
+
+void
+http_ringbuf_free(struct http_ringbuf *rb)
+{
+  if (rb->base != NULL) {
+    munmap(rb->base, 2 * rb->size);
+    rb->base = NULL;
+  }
+}
+
+
+ssize_t
+http_ringbuf_read(struct http_ringbuf *rb, int fd)
+{
+  size_t tail = rb->head + rb->len;
+  ssize_t n;
+
+  /* read() would be asked for 0 bytes and look like EOF */
+  if (rb->len == rb->size) {
+    errno = ENOBUFS;
+    return -1;
+  }
+
+  if (tail >= rb->size) {
+    tail -= rb->size;
+  }
+
+  /* The free space may wrap too, the mirror keeps it contiguous */
+  n = read(fd, rb->base + tail, rb->size - rb->len);
+  if (n > 0) {
+    rb->len += (size_t) n;
+  }
+  return n;
+}
+
+
+void
+http_ringbuf_consume(struct http_ringbuf *rb, size_t n)
+{
+  rb->head += n;
+  if (rb->head >= rb->size) {
+    rb->head -= rb->size;
+  }
+  rb->len -= n;
+}
+
+
+size_t
+http_ringbuf_execute(struct http_ringbuf *rb,
+                     http_parser *parser,
+                     const http_parser_settings *settings)
+{
+  size_t total = 0;
+
+  while (rb->len > 0) {
+    const char *data = rb->base + rb->head;
+    uint64_t remaining = http_parser_body_remaining(parser);
+    size_t n = rb->len;
+    size_t nparsed;
+
+    if (remaining != 0) {
+      /* A body can't split a span; stop at its end, the next message
+       * starts with a line again
+       */
+      if (remaining < n) {
+        n = (size_t) remaining;
+      }
+    } else {
+      while (n > 0 && data[n - 1] != '\n') {
+        n--;
+      }
+      if (n == 0) {
+        if (rb->len < rb->size) {
+          break;
+        }
+        n = rb->len;
+      }
+    }
+
+    nparsed = http_parser_execute(parser, settings, data, n);
+    http_ringbuf_consume(rb, nparsed);
+    total += nparsed;
+
+    if (nparsed != n || parser->upgrade ||
+        HTTP_PARSER_ERRNO(parser) != HPE_OK) {
+      break;
+    }
+  }
+
+  return total;
+}
@@ -0,0 +1,71 @@
+/* Copyright Joyent, Inc. and other Node contributors.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Mirrored ring buffer for socket reads (Linux).
+ *
+ * The buffer is mapped twice, back to back, so the unconsumed bytes are
+ * always contiguous in memory even when they wrap around the end. Data is
+ * read straight into the ring and parsed in place, with no copy.
+ *
+ * http_ringbuf_execute() only gives the parser complete lines outside of
+ * bodies and keeps the rest in the ring until more data arrives, so the
+ * URL, status and every header field and value reach their callbacks in
+ * one piece.
+ */
+#ifndef http_ringbuf_h
+#define http_ringbuf_h
+
+#include "http_parser.h"
+#include <sys/types.h>
+
+struct http_ringbuf {
+  char *base;     /* 2 * size bytes; base[i] and base[i + size] alias */
+  size_t size;    /* a multiple of the page size */
+  size_t head;    /* offset of the first unconsumed byte, < size */
+  size_t len;     /* number of unconsumed bytes */
+};
+
+/* Map a ring of at least `size` bytes; return -1 and set errno on failure */
+int http_ringbuf_init(struct http_ringbuf *rb, size_t size);
+
+void http_ringbuf_free(struct http_ringbuf *rb);
+
+/* read() from `fd` into the free part of the ring. Returns what read()
+ * returns, or -1 with errno set to ENOBUFS when the ring is full, so 0
+ * always means EOF.
+ */
+ssize_t http_ringbuf_read(struct http_ringbuf *rb, int fd);
+
+/* Drop `n` bytes from the front of the ring */
+void http_ringbuf_consume(struct http_ringbuf *rb, size_t n);
+
+/* Run `parser` over the unconsumed bytes and drop what it consumed.
+ * Returns the number of bytes consumed. Stops early on an error, a pause
+ * or an upgrade, like http_parser_execute(). Outside of bodies, bytes
+ * after the last LF are held back unless the ring is full, which only
+ * happens for a line longer than the ring. At EOF, pass the bytes still
+ * in the ring to http_parser_execute() and then signal EOF as usual.
+ */
+size_t http_ringbuf_execute(struct http_ringbuf *rb,
+                            http_parser *parser,
+                            const http_parser_settings *settings);
+
+#endif
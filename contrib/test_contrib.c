@@ -0,0 +1,562 @@
+/* Copyright Joyent, Inc. and other Node contributors.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Tests for the contrib helpers that are built as object files:
+ * ringbuf.o, pipeline.o and recorder.o. Run with `make test-contrib`,
+ * which also replays the redacted log written here with record_replay.
+ */
+#include "http_parser.h"
+#include "pipeline.h"
+#include "recorder.h"
+#include "ringbuf.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RECORDER_LOG "test_contrib.log"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static int url_calls;
+static int header_value_calls;
+static int messages;
+static char last_url[64];
+static char last_header_value[64];
+
+static void
+copy_span (char *dst, size_t size, const char *at, size_t len)
+{
+  assert(len < size);
+  memcpy(dst, at, len);
+  dst[len] = '\0';
+}
+
+static int
+url_cb (http_parser *p, const char *at, size_t len)
+{
+  (void)p;
+  url_calls++;
+  copy_span(last_url, sizeof(last_url), at, len);
+  return 0;
+}
+
+static int
+header_value_cb (http_parser *p, const char *at, size_t len)
+{
+  (void)p;
+  header_value_calls++;
+  copy_span(last_header_value, sizeof(last_header_value), at, len);
+  return 0;
+}
+
+static int
+message_complete_cb (http_parser *p)
+{
+  (void)p;
+  messages++;
+  return 0;
+}
+
+static http_parser_settings settings =
+  {.on_url = url_cb
+  ,.on_header_value = header_value_cb
+  ,.on_message_complete = message_complete_cb
+  };
+
+static void
+reset_counts (void)
+{
+  url_calls = 0;
+  header_value_calls = 0;
+  messages = 0;
+}
+
+/* Write `s` to the pipe and read it into the ring */
+static void
+ringbuf_feed (struct http_ringbuf *rb, int fds[2], const char *s)
+{
+  ssize_t n;
+
+  assert(write(fds[1], s, strlen(s)) == (ssize_t) strlen(s));
+  n = http_ringbuf_read(rb, fds[0]);
+  assert(n == (ssize_t) strlen(s));
+}
+
+/* Partial lines stay in the ring, bodies are passed up to their end */
+static void
+test_ringbuf_execute (void)
+{
+  struct http_ringbuf rb;
+  http_parser parser;
+  int fds[2];
+  size_t n;
+
+  assert(pipe(fds) == 0);
+  assert(http_ringbuf_init(&rb, 1) == 0);
+
+  /* Bytes after the last LF are held back */
+  reset_counts();
+  http_parser_init(&parser, HTTP_REQUEST);
+  ringbuf_feed(&rb, fds, "GET /index.html HTTP/1.1\r\nHost: ex");
+  n = http_ringbuf_execute(&rb, &parser, &settings);
+  assert(n == strlen("GET /index.html HTTP/1.1\r\n"));
+  assert(rb.len == strlen("Host: ex"));
+  assert(url_calls == 1);
+  assert(strcmp(last_url, "/index.html") == 0);
+  assert(header_value_calls == 0);
+
+  ringbuf_feed(&rb, fds, "ample.com\r\n\r\n");
+  n = http_ringbuf_execute(&rb, &parser, &settings);
+  assert(n == strlen("Host: example.com\r\n\r\n"));
+  assert(rb.len == 0);
+  assert(header_value_calls == 1);
+  assert(strcmp(last_header_value, "example.com") == 0);
+  assert(messages == 1);
+
+  /* A body is passed up to its end, not into the next request line */
+  reset_counts();
+  http_parser_init(&parser, HTTP_REQUEST);
+  ringbuf_feed(&rb, fds, "POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\nhel");
+  n = http_ringbuf_execute(&rb, &parser, &settings);
+  assert(rb.len == 0);
+  assert(http_parser_body_remaining(&parser) == 2);
+
+  ringbuf_feed(&rb, fds, "loGET /ne");
+  n = http_ringbuf_execute(&rb, &parser, &settings);
+  assert(n == 2);
+  assert(messages == 1);
+  assert(rb.len == strlen("GET /ne"));
+  assert(url_calls == 1);
+
+  ringbuf_feed(&rb, fds, "xt HTTP/1.1\r\n\r\n");
+  n = http_ringbuf_execute(&rb, &parser, &settings);
+  assert(rb.len == 0);
+  assert(url_calls == 2);
+  assert(strcmp(last_url, "/next") == 0);
+  assert(messages == 2);
+
+  http_ringbuf_free(&rb);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+/* Many requests through a small ring: the data wraps around its end */
+static void
+test_ringbuf_wrap (void)
+{
+  const char *req = "GET /wrap/around HTTP/1.1\r\nHost: example.com\r\n\r\n";
+  struct http_ringbuf rb;
+  http_parser parser;
+  int fds[2];
+  int i;
+
+  assert(pipe(fds) == 0);
+  assert(http_ringbuf_init(&rb, 1) == 0);
+
+  reset_counts();
+  http_parser_init(&parser, HTTP_REQUEST);
+  for (i = 0; (size_t) i < 3 * rb.size / strlen(req); i++) {
+    ringbuf_feed(&rb, fds, req);
+    http_ringbuf_execute(&rb, &parser, &settings);
+    assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+    assert(rb.len == 0);
+    assert(strcmp(last_url, "/wrap/around") == 0);
+    assert(strcmp(last_header_value, "example.com") == 0);
+  }
+  assert(url_calls == i);
+  assert(header_value_calls == i);
+  assert(messages == i);
+
+  http_ringbuf_free(&rb);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+/* A full ring is an error, not EOF */
+static void
+test_ringbuf_full (void)
+{
+  static char line[4096];
+  struct http_ringbuf rb;
+  int fds[2];
+  size_t i;
+
+  assert(pipe(fds) == 0);
+  assert(http_ringbuf_init(&rb, 1) == 0);
+
+  memset(line, 'a', sizeof(line));
+  for (i = 0; i < rb.size; i += sizeof(line)) {
+    assert(write(fds[1], line, sizeof(line)) == (ssize_t) sizeof(line));
+  }
+  while (rb.len < rb.size) {
+    assert(http_ringbuf_read(&rb, fds[0]) > 0);
+  }
+
+  errno = 0;
+  assert(http_ringbuf_read(&rb, fds[0]) == -1);
+  assert(errno == ENOBUFS);
+
+  http_ringbuf_consume(&rb, 1);
+  close(fds[1]);
+  assert(http_ringbuf_read(&rb, fds[0]) == 0);
+
+  http_ringbuf_free(&rb);
+  close(fds[0]);
+}
+
+static const struct {
+  const char *data;
+  int ret;
+  size_t extent;  /* for ret == 1, 0 means all of data */
+} scan_tests[] =
+{ {"GET / HTTP/1.1\r\nHost: a\r\n\r\n", 1, 0}
+, {"\r\nGET / HTTP/1.1\r\n\r\nGET /b", 1, 20}
+, {"POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\nhelloGET", 1, 43}
+, {"POST / HTTP/1.1\r\ncontent-length:5\r\n\r\nhello", 1, 0}
+, {"POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+   "5\r\nhello\r\n0\r\nVary: *\r\n\r\n", 1, 0}
+, {"GET / HTTP/1.1\r\nHost: a\r\n", 0, 0}
+, {"POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\nhel", 0, 0}
+, {"POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhe", 0, 0}
+  /* Names the parser might frame differently */
+, {"POST / HTTP/1.1\r\nContent-Length : 5\r\n\r\nhello", -1, 0}
+, {"POST / HTTP/1.1\r\nContent-Length\t: 5\r\n\r\nhello", -1, 0}
+, {"POST / HTTP/1.1\r\nContent-Length\x01: 5\r\n\r\nhello", -1, 0}
+, {"POST / HTTP/1.1\r\n Content-Length: 5\r\n\r\nhello", -1, 0}
+, {"POST / HTTP/1.1\r\nTransfer-Encoding : chunked\r\n\r\n0\r\n\r\n",
+   -1, 0}
+, {"GET / HTTP/1.1\r\n: empty\r\n\r\n", -1, 0}
+, {"GET / HTTP/1.1\r\nno colon\r\n\r\n", -1, 0}
+  /* Framing left to the parser */
+, {"GET / HTTP/1.1\r\nUpgrade: websocket\r\n\r\n", -1, 0}
+, {"CONNECT a:443 HTTP/1.1\r\n\r\n", -1, 0}
+, {"GET / HTTP/1.1\r\nX: a\r\n b\r\n\r\n", -1, 0}
+, {"POST / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 1\r\n\r\na",
+   -1, 0}
+, {"POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n", -1, 0}
+};
+
+static void
+test_pipeline_scan (void)
+{
+  size_t extent;
+  unsigned int i;
+  int ret;
+
+  for (i = 0; i < ARRAY_SIZE(scan_tests); i++) {
+    extent = 0;
+    ret = http_pipeline_scan(scan_tests[i].data, strlen(scan_tests[i].data),
+                             &extent);
+    if (ret != scan_tests[i].ret ||
+        (ret == 1 && extent != (scan_tests[i].extent ?
+                                scan_tests[i].extent :
+                                strlen(scan_tests[i].data)))) {
+      fprintf(stderr, "\n*** http_pipeline_scan(\"%s\") gave %d, "
+              "extent %u ***\n\n",
+              scan_tests[i].data, ret, (unsigned int) extent);
+      assert(0);
+    }
+  }
+}
+
+/* Per job results, reached through parser.data */
+struct job_result {
+  int urls;
+  int messages;
+};
+
+static int
+job_url_cb (http_parser *p, const char *at, size_t len)
+{
+  (void)at;
+  (void)len;
+  ((struct job_result *) p->data)->urls++;
+  return 0;
+}
+
+static int
+job_message_complete_cb (http_parser *p)
+{
+  ((struct job_result *) p->data)->messages++;
+  return 0;
+}
+
+static http_parser_settings job_settings =
+  {.on_url = job_url_cb
+  ,.on_message_complete = job_message_complete_cb
+  };
+
+static void
+test_pipeline_parse (void)
+{
+  static const char *reqs[] =
+    { "GET /a HTTP/1.1\r\nHost: x\r\n\r\n"
+    , "POST /b HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc"
+    , "POST /c HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+      "3\r\nabc\r\n0\r\n\r\n"
+    };
+  static char buf[100 * 128];
+  static struct http_pipeline_job jobs[100];
+  static struct job_result results[100];
+  size_t len = 0;
+  size_t consumed;
+  size_t njobs;
+  size_t i;
+  unsigned int nthreads;
+
+  for (i = 0; i < ARRAY_SIZE(jobs); i++) {
+    strcpy(buf + len, reqs[i % ARRAY_SIZE(reqs)]);
+    len += strlen(reqs[i % ARRAY_SIZE(reqs)]);
+  }
+  strcpy(buf + len, "GET /partial HTTP/1.1\r\n");
+
+  /* Split stops at the incomplete request and at max_jobs */
+  njobs = http_pipeline_split(buf, strlen(buf), jobs, ARRAY_SIZE(jobs) + 1,
+                              &consumed);
+  assert(njobs == ARRAY_SIZE(jobs));
+  assert(consumed == len);
+  assert(jobs[0].data == buf);
+  assert(jobs[1].data == buf + strlen(reqs[0]));
+  assert(jobs[1].len == strlen(reqs[1]));
+  assert(http_pipeline_split(buf, len, jobs, 2, &consumed) == 2);
+  assert(consumed == strlen(reqs[0]) + strlen(reqs[1]));
+
+  for (nthreads = 1; nthreads <= 4; nthreads *= 2) {
+    njobs = http_pipeline_split(buf, len, jobs, ARRAY_SIZE(jobs), &consumed);
+    memset(results, 0, sizeof(results));
+    for (i = 0; i < njobs; i++) {
+      jobs[i].parser.data = &results[i];
+    }
+    assert(http_pipeline_parse(jobs, njobs, &job_settings, nthreads) == njobs);
+    for (i = 0; i < njobs; i++) {
+      assert(jobs[i].ok);
+      assert(results[i].urls == 1);
+      assert(results[i].messages == 1);
+    }
+
+    /* A job cut short: the run ends there */
+    jobs[40].len -= 2;
+    memset(results, 0, sizeof(results));
+    assert(http_pipeline_parse(jobs, njobs, &job_settings, nthreads) == 40);
+    assert(!jobs[40].ok);
+    assert(results[40].messages == 0);
+    for (i = 0; i < 40; i++) {
+      assert(results[i].messages == 1);
+    }
+    if (nthreads == 1) {
+      /* Serially no job past it is started */
+      for (i = 41; i < njobs; i++) {
+        assert(results[i].urls == 0);
+      }
+    }
+  }
+}
+
+/* A request closing the connection ends the split, and the pipeline then
+ * gives what a serial parser gives, whether HTTP_PARSER_STRICT stops it
+ * there or not.
+ */
+static void
+test_pipeline_close (void)
+{
+  static const struct {
+    const char *data;
+    size_t njobs;
+  } tests[] =
+    { { "GET /a HTTP/1.1\r\n\r\n"
+        "GET /b HTTP/1.1\r\nConnection: close\r\n\r\n"
+        "GET /c HTTP/1.1\r\n\r\n"
+        "GET /d HTTP/1.1\r\n\r\n", 2 }
+    , { "GET /a HTTP/1.0\r\nConnection: keep-alive\r\n\r\n"
+        "GET /b HTTP/1.0\r\n\r\n"
+        "GET /c HTTP/1.1\r\n\r\n", 2 }
+    , { "GET /a HTTP/1.1\r\nConnection: upgrade, Close\r\n\r\n"
+        "\r\n", 1 }
+    , { "GET /a HTTP/1.1\r\nConnection: closed\r\n\r\n"
+        "GET /b HTTP/1.1\r\n\r\n", 2 }
+    };
+  struct http_pipeline_job jobs[4];
+  struct job_result serial, piped, tail;
+  http_parser parser;
+  enum http_errno serial_errno, piped_errno;
+  size_t consumed;
+  size_t njobs;
+  size_t ok;
+  size_t len;
+  size_t i, j;
+
+  for (i = 0; i < ARRAY_SIZE(tests); i++) {
+    len = strlen(tests[i].data);
+
+    memset(&serial, 0, sizeof(serial));
+    http_parser_init(&parser, HTTP_REQUEST);
+    parser.data = &serial;
+    http_parser_execute(&parser, &job_settings, tests[i].data, len);
+    serial_errno = HTTP_PARSER_ERRNO(&parser);
+
+    njobs = http_pipeline_split(tests[i].data, len, jobs, ARRAY_SIZE(jobs),
+                                &consumed);
+    assert(njobs == tests[i].njobs);
+    assert(consumed == len);
+    assert(jobs[njobs - 1].tail == (i != ARRAY_SIZE(tests) - 1));
+
+    memset(&piped, 0, sizeof(piped));
+    for (j = 0; j < njobs; j++) {
+      jobs[j].parser.data = &piped;
+    }
+    ok = http_pipeline_parse(jobs, njobs, &job_settings, 1);
+    piped_errno = HPE_OK;
+    if (ok < njobs) {
+      /* Results from the failed job on are thrown away */
+      memset(&tail, 0, sizeof(tail));
+      http_parser_init(&parser, HTTP_REQUEST);
+      parser.data = &tail;
+      http_parser_execute(&parser, &job_settings, jobs[ok].data,
+                          len - (jobs[ok].data - tests[i].data));
+      piped_errno = HTTP_PARSER_ERRNO(&parser);
+      piped.messages = ok + tail.messages;
+    }
+
+    if (piped.messages != serial.messages || piped_errno != serial_errno) {
+      fprintf(stderr, "\n*** pipeline gave %d messages, %s; serially %d, "
+              "%s ***\n\n%s\n", piped.messages, http_errno_name(piped_errno),
+              serial.messages, http_errno_name(serial_errno),
+              tests[i].data);
+      assert(0);
+    }
+  }
+}
+
+/* Redacted logs keep the framing and nothing else, also for a call that
+ * failed in the middle of a span and for the bytes it did not consume.
+ */
+static const struct {
+  enum http_parser_type type;
+  const char *raw;
+  size_t split;
+  enum http_errno error;
+} record_tests[] = {
+  { HTTP_REQUEST,
+    "GET /secret?token=abc HTTP/1.1\r\n"
+    "Authorization: Bearer SECRETKEY\x01zz\r\n\r\n",
+    20, HPE_INVALID_HEADER_TOKEN },
+  { HTTP_REQUEST,
+    "POST /upload HTTP/1.1\r\n"
+    "Content-Length: 6\r\n"
+    "Cookie: session=SECRETKEY\r\n\r\n"
+    "secretGET /x HTTP/1.1\r\n\r\n",
+    42, HPE_OK },
+  { HTTP_RESPONSE,
+    "HTTP/1.1 200 Secret\r\n"
+    "Transfer-Encoding: chunked\r\n\r\n"
+    "6;token=SECRETKEY\r\nsecret\r\n"
+    "0\r\n\r\n",
+    50, HPE_OK }
+};
+
+static int
+contains (const char *buf, size_t len, const char *s)
+{
+  size_t n = strlen(s);
+  size_t i;
+
+  for (i = 0; i + n <= len; i++) {
+    if (memcmp(buf + i, s, n) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void
+test_recorder_redact (void)
+{
+  http_parser_settings settings;
+  struct http_recorder *rec;
+  char log[1024];
+  size_t loglen;
+  FILE *file;
+  unsigned i;
+
+  memset(&settings, 0, sizeof(settings));
+  rec = http_recorder_open(RECORDER_LOG, HTTP_RECORDER_REDACT);
+  assert(rec != NULL);
+
+  for (i = 0; i < ARRAY_SIZE(record_tests); i++) {
+    const char *raw = record_tests[i].raw;
+    size_t len = strlen(raw);
+    size_t split = record_tests[i].split;
+    struct http_recorder_conn conn;
+    http_parser parser;
+    size_t parsed;
+
+    http_parser_init(&parser, record_tests[i].type);
+    http_recorder_conn_init(rec, &conn);
+
+    parsed = http_recorder_execute(rec, &conn, &parser, &settings,
+                                   raw, split);
+    assert(parsed == split);
+    parsed = http_recorder_execute(rec, &conn, &parser, &settings,
+                                   raw + split, len - split);
+    if (HTTP_PARSER_ERRNO(&parser) == HPE_OK) {
+      assert(parsed == len - split);
+      http_recorder_execute(rec, &conn, &parser, &settings, NULL, 0);
+    }
+    assert(HTTP_PARSER_ERRNO(&parser) == record_tests[i].error);
+  }
+  assert(http_recorder_close(rec) == 0);
+
+  file = fopen(RECORDER_LOG, "rb");
+  assert(file != NULL);
+  loglen = fread(log, 1, sizeof(log), file);
+  assert(loglen < sizeof(log));
+  fclose(file);
+
+  assert(!contains(log, loglen, "SECRETKEY"));
+  assert(!contains(log, loglen, "ecret"));
+  assert(!contains(log, loglen, "token"));
+  assert(!contains(log, loglen, "session"));
+  assert(!contains(log, loglen, "Bearer"));
+
+  assert(contains(log, loglen, "GET /aaaaaa?aaaaa=aa"));
+  assert(contains(log, loglen, "Authorization: "));
+  assert(contains(log, loglen, "Content-Length: 6\r\n"));
+  assert(contains(log, loglen, "Transfer-Encoding: chunked\r\n"));
+  assert(contains(log, loglen, "HTTP/1.1 200 Aaaaaa\r\n"));
+  assert(contains(log, loglen, "6;aaaaa=AAAAAAAAA\r\n"));
+}
+
+int
+main (void)
+{
+  test_ringbuf_execute();
+  test_ringbuf_wrap();
+  test_ringbuf_full();
+  test_pipeline_scan();
+  test_pipeline_parse();
+  test_pipeline_close();
+  test_recorder_redact();
+
+  printf("contrib okay\n");
+  return 0;
+}
@@ -25,6 +25,10 @@
 #include <string.h>
 #include <limits.h>
 
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
 static uint32_t max_header_size = HTTP_MAX_HEADER_SIZE;
 
 #ifndef ULLONG_MAX
@@ -51,7 +55,7 @@ static uint32_t max_header_size = HTTP_MAX_HEADER_SIZE;
 
 #define SET_ERRNO(e)                                                 \
 do {                                                                 \
-  parser->nread = nread;                                             \
+  parser->nread = HEADER_NREAD();                                    \
   parser->http_errno = (e);                                          \
 } while(0)
 
@@ -59,10 +63,17 @@ do {                                                                 \
 #define UPDATE_STATE(V) p_state = (enum state) (V);
 #define RETURN(V)                                                    \
 do {                                                                 \
-  parser->nread = nread;                                             \
+  parser->nread = HEADER_NREAD();                                    \
   parser->state = CURRENT_STATE();                                   \
   return (V);                                                        \
 } while (0);
+/* Count a completed message and stop once `max_messages` are done */
+#define MESSAGE_BUDGET(V)                                            \
+do {                                                                 \
+  if (UNLIKELY(++nmessages == max_messages)) {                       \
+    RETURN(V);                                                       \
+  }                                                                  \
+} while (0)
 #define REEXECUTE()                                                  \
   goto reexecute;                                                    \
 
@@ -70,9 +81,35 @@ do {                                                                 \
 #ifdef __GNUC__
 # define LIKELY(X) __builtin_expect(!!(X), 1)
 # define UNLIKELY(X) __builtin_expect(!!(X), 0)
+# define NOINLINE __attribute__((noinline))
+# define PREFETCH(A, RW) __builtin_prefetch((A), (RW))
 #else
 # define LIKELY(X) (X)
 # define UNLIKELY(X) (X)
+# define NOINLINE
+# define PREFETCH(A, RW)
+#endif
+
+/* Compile with -DHTTP_PARSER_COMPUTED_GOTO=0 to dispatch states with the
+ * switch in http_parser_execute() only. Otherwise compilers that support
+ * labels as values jump straight to each state through a table of label
+ * addresses, which gives every dispatch site its own indirect branch.
+ */
+#ifndef HTTP_PARSER_COMPUTED_GOTO
+# ifdef __GNUC__
+#  define HTTP_PARSER_COMPUTED_GOTO 1
+# else
+#  define HTTP_PARSER_COMPUTED_GOTO 0
+# endif
+#endif
+
+#if HTTP_PARSER_COMPUTED_GOTO
+# define STATE_CASE(S)    case S: L_##S
+# define STATE_LABEL(S)   [S] = &&L_##S
+# define DISPATCH()       goto *dispatch_table[CURRENT_STATE()]
+#else
+# define STATE_CASE(S)    case S
+# define DISPATCH()
 #endif
 
 
@@ -132,6 +169,35 @@ do {                                                                 \
 #define CALLBACK_DATA_NOADVANCE(FOR)                                 \
     CALLBACK_DATA_(FOR, p - FOR##_mark, p - data)
 
+/* Run the on_header callback for the header line that ends at the current
+ * byte and don't consume the current byte
+ */
+#define CALLBACK_HEADER_NOADVANCE()                                  \
+do {                                                                 \
+  assert(HTTP_PARSER_ERRNO(parser) == HPE_OK);                       \
+                                                                     \
+  if (LIKELY(!header_line_skip)) {                                   \
+    parser->state = CURRENT_STATE();                                 \
+    if (UNLIKELY(0 != settings->on_header(parser,                    \
+                        header_field_mark,                           \
+                        header_field_end - header_field_mark,        \
+                        header_value_mark,                           \
+                        header_value_end - header_value_mark))) {    \
+      SET_ERRNO(HPE_CB_header);                                      \
+    }                                                                \
+    UPDATE_STATE(parser->state);                                     \
+  }                                                                  \
+  header_line_skip = 0;                                              \
+  header_line_mark = NULL;                                           \
+  header_field_mark = NULL;                                          \
+  header_value_mark = NULL;                                          \
+                                                                     \
+  /* We either errored above or got paused; get out */               \
+  if (UNLIKELY(HTTP_PARSER_ERRNO(parser) != HPE_OK)) {               \
+    return (p - data);                                               \
+  }                                                                  \
+} while (0)
+
 /* Set the mark FOR; non-destructive if mark is already set */
 #define MARK(FOR)                                                    \
 do {                                                                 \
@@ -150,21 +216,50 @@ do {                                                                 \
  * make the web a little safer.  max_header_size is still far bigger
  * than any reasonable request or response so this should never affect
  * day-to-day operation.
+ *
+ * The size is counted per span instead of per byte. While the parser is in
+ * a header state, `nread` holds the count before `span_start` and every byte
+ * from `span_start` on counts too. `loop_end` is pulled in to the first byte
+ * that would take the count past max_header_size: the main loop and the
+ * inner loops of the header states stop there and the overflow is reported
+ * on exactly that byte.
  */
-#define COUNT_HEADER_SIZE(V)                                         \
+
+/* Header bytes counted up to and including the current byte */
+#define HEADER_NREAD()                                               \
+  (span_start ? nread + (uint32_t) (p - span_start) + 1 : nread)
+
+/* Start a new span at S, with V bytes counted before it, for the state just
+ * entered
+ */
+#define START_HEADER_SPAN(V, S)                                      \
 do {                                                                 \
-  nread += (uint32_t)(V);                                            \
-  if (UNLIKELY(nread > max_header_size)) {                           \
-    SET_ERRNO(HPE_HEADER_OVERFLOW);                                  \
-    goto error;                                                      \
+  size_t left_;                                                      \
+                                                                     \
+  nread = (V);                                                       \
+  loop_end = data + len;                                             \
+  if (PARSING_HEADER(CURRENT_STATE())) {                             \
+    span_start = (S);                                                \
+    left_ = nread < max_header_size ? max_header_size - nread : 0;   \
+    if ((size_t) (loop_end - span_start) > left_) {                  \
+      loop_end = span_start + left_;                                 \
+    }                                                                \
+  } else {                                                           \
+    span_start = NULL;                                               \
   }                                                                  \
 } while (0)
 
+/* The fast line parsers count a whole line, up to and including LF, before
+ * running its callbacks; the span restarts after the line with
+ * START_HEADER_SPAN(nread, lf + 1)
+ */
+#define COUNT_HEADER_LINE(LF)                                        \
+do {                                                                 \
+  nread = HEADER_NREAD() + (uint32_t) ((LF) - p);                    \
+  span_start = NULL;                                                 \
+} while (0)
+
 
-#define PROXY_CONNECTION "proxy-connection"
-#define CONNECTION "connection"
-#define CONTENT_LENGTH "content-length"
-#define TRANSFER_ENCODING "transfer-encoding"
 #define UPGRADE "upgrade"
 #define CHUNKED "chunked"
 #define KEEP_ALIVE "keep-alive"
@@ -179,6 +274,7 @@ static const char *method_strings[] =
   };
 
 
+/* BEGIN GENERATED char classes */
 /* Tokens as defined by rfc 2616. Also lowercases them.
  *        token       = 1*<any CHAR except CTLs or separators>
  *     separators     = "(" | ")" | "<" | ">" | "@"
@@ -187,9 +283,9 @@ static const char *method_strings[] =
  *                    | "{" | "}" | SP | HT
  */
 static const char tokens[256] = {
-/*   0 nul    1 soh    2 stx    3 etx    4 eot    5 enq    6 ack    7 bel  */
+/*   0 nul    1 soh    2 stx    3 etx    4 eot    5 enq    6 ack    7 bel */
         0,       0,       0,       0,       0,       0,       0,       0,
-/*   8 bs     9 ht    10 nl    11 vt    12 np    13 cr    14 so    15 si   */
+/*   8 bs     9 ht    10 nl    11 vt    12 np    13 cr    14 so    15 si  */
         0,       0,       0,       0,       0,       0,       0,       0,
 /*  16 dle   17 dc1   18 dc2   19 dc3   20 dc4   21 nak   22 syn   23 etb */
         0,       0,       0,       0,       0,       0,       0,       0,
@@ -218,7 +314,7 @@ static const char tokens[256] = {
 /* 112  p   113  q   114  r   115  s   116  t   117  u   118  v   119  w  */
        'p',     'q',     'r',     's',     't',     'u',     'v',     'w',
 /* 120  x   121  y   122  z   123  {   124  |   125  }   126  ~   127 del */
-       'x',     'y',     'z',      0,      '|',      0,      '~',       0 };
+       'x',     'y',     'z',      0,      '|',      0,      '~',      0 };
 
 
 static const int8_t unhex[256] =
@@ -241,9 +337,9 @@ static const int8_t unhex[256] =
 
 
 static const uint8_t normal_url_char[32] = {
-/*   0 nul    1 soh    2 stx    3 etx    4 eot    5 enq    6 ack    7 bel  */
+/*   0 nul    1 soh    2 stx    3 etx    4 eot    5 enq    6 ack    7 bel */
         0    |   0    |   0    |   0    |   0    |   0    |   0    |   0,
-/*   8 bs     9 ht    10 nl    11 vt    12 np    13 cr    14 so    15 si   */
+/*   8 bs     9 ht    10 nl    11 vt    12 np    13 cr    14 so    15 si  */
         0    | T(2)   |   0    |   0    | T(16)  |   0    |   0    |   0,
 /*  16 dle   17 dc1   18 dc2   19 dc3   20 dc4   21 nak   22 syn   23 etb */
         0    |   0    |   0    |   0    |   0    |   0    |   0    |   0,
@@ -275,6 +371,7 @@ static const uint8_t normal_url_char[32] = {
         1    |   2    |   4    |   8    |   16   |   32   |   64   |   0, };
 
 #undef T
+/* END GENERATED char classes */
 
 enum state
   { s_dead = 1 /* important that this is > 0 */
@@ -364,22 +461,18 @@ enum state
 
 enum header_states
   { h_general = 0
-  , h_C
-  , h_CO
-  , h_CON
-
-  , h_matching_connection
-  , h_matching_proxy_connection
-  , h_matching_content_length
-  , h_matching_transfer_encoding
-  , h_matching_upgrade
 
+  /* BEGIN GENERATED header name states */
+  , h_name_first = h_general + 1
+  , h_name_last = h_name_first + 50
   , h_connection
   , h_content_length
-  , h_content_length_num
-  , h_content_length_ws
   , h_transfer_encoding
   , h_upgrade
+  /* END GENERATED header name states */
+
+  , h_content_length_num
+  , h_content_length_ws
 
   , h_matching_transfer_encoding_token_start
   , h_matching_transfer_encoding_chunked
@@ -397,6 +490,96 @@ enum header_states
   , h_connection_upgrade
   };
 
+/* BEGIN GENERATED header names */
+/* Matcher for the header names the parser acts on, a minimal DFA over
+ * lowercased bytes. Its states are the header_states from h_name_first
+ * (nothing matched yet) to h_name_last. Each byte leads to another of
+ * them, to h_general once the name can't be one of those, or to the
+ * name's own header_state after its last byte.
+ */
+#define HEADER_NAME_NEXT(state, c)                                     \
+  header_name_dfa[(state) - h_name_first]                              \
+                 [header_name_class[(unsigned char) (c)]]
+
+/* Bit n is set if one of the names is n bytes long */
+#define HEADER_NAME_LENGTHS 0x00034480UL
+
+static const uint8_t header_name_class[256] =
+  { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+  , 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+  , 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0
+  , 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+  , 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+  , 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+  , 0, 2, 0, 3, 4, 5, 6, 7, 8, 9, 0, 0,10, 0,11,12
+  ,13, 0,14,15,16,17, 0, 0,18,19, 0, 0, 0, 0, 0, 0
+  , 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+  , 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+  , 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+  , 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+  , 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+  , 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+  , 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+  , 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+  };
+
+/*                                -  a  c  d  e  f  g  h  i  l  n  o  p  r  s  t  u  x  y */
+static const uint8_t header_name_dfa[51][20] =
+  { /* h_name_first +  0 */ { 0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 0, 0, 4, 5, 0, 0}
+  , /* h_name_first +  1 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 6, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first +  2 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 0, 0, 0, 0, 0}
+  , /* h_name_first +  3 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 8, 0, 0, 0, 0, 0}
+  , /* h_name_first +  4 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 9, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first +  5 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,10, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first +  6 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,11, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first +  7 */ { 0, 0,12, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first +  8 */ { 0, 0, 0, 0, 0, 0, 0,13, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first +  9 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,14, 0, 0, 0, 0,15, 0, 0, 0}
+  , /* h_name_first + 10 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,16, 0}
+  , /* h_name_first + 11 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,17, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 12 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,18, 0, 0, 0, 0, 0}
+  , /* h_name_first + 13 */ { 0, 0, 0, 0, 0,19, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 14 */ { 0, 0, 0, 0, 0,20, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 15 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,21}
+  , /* h_name_first + 16 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,22, 0, 0, 0, 0}
+  , /* h_name_first + 17 */ { 0, 0,23, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 18 */ { 0, 0, 0,24, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 19 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,25, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 20 */ { 0,26, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 21 */ { 0, 0, 0, 0, 0, 0,27, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 22 */ { 0, 0, 0, 0,28, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 23 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,29, 0, 0, 0}
+  , /* h_name_first + 24 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,30, 0, 0, 0}
+  , /* h_name_first + 25 */ { 0, 0, 0,31, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 26 */ { 0, 0, 0, 0, 0,32, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 27 */ { 0, 0, 0, 0, 0,55, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 28 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0,33, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 29 */ { 0,34, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 30 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,35, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 31 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,36, 0, 0, 0, 0, 0}
+  , /* h_name_first + 32 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,37, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 33 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,38, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 34 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,39, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 35 */ { 0,40, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 36 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,52, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 37 */ { 0, 0, 0, 0, 0,41, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 38 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,14, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 39 */ { 0, 0, 0, 0, 0,42, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 40 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,43, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 41 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,44, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 42 */ { 0, 0, 0, 0, 0, 0, 0,45, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 43 */ { 0, 0, 0,46, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 44 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,47, 0, 0, 0}
+  , /* h_name_first + 45 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,48, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 46 */ { 0, 0, 0, 0, 0, 0, 0, 0,53, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 47 */ { 0, 0, 0, 0,49, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 48 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0,50, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 49 */ { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,51, 0, 0, 0, 0, 0, 0, 0, 0}
+  , /* h_name_first + 50 */ { 0, 0, 0, 0, 0, 0, 0,54, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+  };
+/* END GENERATED header names */
+
+
 enum http_host_state
   {
     s_http_host_dead = 1
@@ -427,6 +610,8 @@ enum http_host_state
 #define IS_USERINFO_CHAR(c) (IS_ALPHANUM(c) || IS_MARK(c) || (c) == '%' || \
   (c) == ';' || (c) == ':' || (c) == '&' || (c) == '=' || (c) == '+' || \
   (c) == '$' || (c) == ',')
+#define IS_UNRESERVED(c)    (IS_ALPHANUM(c) || (c) == '-' || (c) == '.' || \
+  (c) == '_' || (c) == '~')
 
 #define STRICT_TOKEN(c)     ((c == ' ') ? 0 : tokens[(unsigned char)c])
 
@@ -638,10 +823,351 @@ parse_url_char(enum state s, const char ch)
   return s_dead;
 }
 
+/* Return the first byte in [p, end) that is a control character other than
+ * HT, i.e. CR, LF or a byte rejected by IS_HEADER_CHAR(), or `end` if there
+ * is none. Header values and reason phrases are scanned with this, 16 bytes
+ * at a time where SSE2 is available.
+ */
+static const char *
+scan_header_value(const char *p, const char *end)
+{
+#ifdef __SSE2__
+  const __m128i ctl_max = _mm_set1_epi8(31);
+  const __m128i ht = _mm_set1_epi8(9);
+  const __m128i del = _mm_set1_epi8(127);
+
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(v, ctl_max), v);
+    __m128i bad = _mm_or_si128(_mm_andnot_si128(_mm_cmpeq_epi8(v, ht), ctl),
+                               _mm_cmpeq_epi8(v, del));
+    int mask = _mm_movemask_epi8(bad);
+
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+
+  for (; p != end; p++) {
+    if (*p == CR || *p == LF || !IS_HEADER_CHAR(*p)) {
+      break;
+    }
+  }
+
+  return p;
+}
+
+/* BEGIN GENERATED methods */
+/* Start the method matcher on the first byte `ch` of a request.
+ * Returns 0 if no known method starts with it.
+ */
+static int
+match_method_start(unsigned int *method, char ch)
+{
+  switch (ch) {
+    case 'A': *method = HTTP_ACL; break;
+    case 'B': *method = HTTP_BIND; break;
+    case 'C': *method = HTTP_CONNECT; break;
+    case 'D': *method = HTTP_DELETE; break;
+    case 'G': *method = HTTP_GET; break;
+    case 'H': *method = HTTP_HEAD; break;
+    case 'L': *method = HTTP_LOCK; break;
+    case 'M': *method = HTTP_MKCOL; break;
+    case 'N': *method = HTTP_NOTIFY; break;
+    case 'O': *method = HTTP_OPTIONS; break;
+    case 'P': *method = HTTP_POST; break;
+    case 'R': *method = HTTP_REPORT; break;
+    case 'S': *method = HTTP_SUBSCRIBE; break;
+    case 'T': *method = HTTP_TRACE; break;
+    case 'U': *method = HTTP_UNLOCK; break;
+    default:
+      return 0;
+  }
+
+  return 1;
+}
+
+
+/* Advance the method matcher by the `index`th byte `ch` of the method name.
+ * Returns 0 if no known method starts with the bytes seen so far.
+ */
+static int
+match_method_char(unsigned int *method, unsigned int index, char ch)
+{
+  if (ch == method_strings[*method][index]) {
+    return 1;
+  }
+
+  if (!((ch >= 'A' && ch <= 'Z') || ch == '-')) {
+    return 0;
+  }
+
+  switch (*method << 16 | index << 8 | ch) {
+#define XX(meth, pos, ch, new_meth) \
+    case (HTTP_##meth << 16 | pos << 8 | ch): \
+      *method = HTTP_##new_meth; break;
+
+    XX(CONNECT,   1, 'H', CHECKOUT)
+    XX(CONNECT,   2, 'P', COPY)
+    XX(LOCK,      1, 'I', LINK)
+    XX(MKCOL,     1, 'E', MERGE)
+    XX(MKCOL,     1, 'O', MOVE)
+    XX(MKCOL,     1, '-', MSEARCH)
+    XX(MKCOL,     2, 'A', MKACTIVITY)
+    XX(MKCOL,     3, 'A', MKCALENDAR)
+    XX(POST,      1, 'A', PATCH)
+    XX(POST,      1, 'R', PROPFIND)
+    XX(POST,      1, 'U', PUT)
+    XX(REPORT,    2, 'B', REBIND)
+    XX(SUBSCRIBE, 1, 'E', SEARCH)
+    XX(SUBSCRIBE, 1, 'O', SOURCE)
+    XX(UNLOCK,    2, 'B', UNBIND)
+    XX(UNLOCK,    2, 'S', UNSUBSCRIBE)
+    XX(UNLOCK,    3, 'I', UNLINK)
+    XX(PROPFIND,  4, 'P', PROPPATCH)
+    XX(PUT,       2, 'R', PURGE)
+#undef XX
+    default:
+      return 0;
+  }
+
+  return 1;
+}
+/* END GENERATED methods */
+
+
+/* The header_state s_header_field ends up in after the `len` bytes of
+ * `name`, or h_general. Kept out of line: it runs for few names, and
+ * inlining it into http_parser_execute() costs more than the call.
+ */
+static NOINLINE unsigned int
+header_name_state(const char *name, size_t len)
+{
+  unsigned int h_state = h_name_first;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    h_state = HEADER_NAME_NEXT(h_state, TOKEN(name[i]));
+    if (h_state < h_name_first || h_state > h_name_last) {
+      break;
+    }
+  }
+
+  return i + 1 == len ? h_state : h_general;
+}
+
+
+/* Fast paths.
+ *
+ * When a whole request line, status line or header line is already in the
+ * buffer, http_parser_execute() parses it in one go instead of running one
+ * state per byte. The helpers below only look at the bytes: they return the
+ * position of the LF ending the line, or NULL if the line is not complete
+ * or is anything but the common case. The state machine then parses the
+ * line as usual, so results, callbacks and errors are the same either way.
+ */
+
+/* Request line whose first byte has been matched into `*method` */
+static const char *
+fast_request_line(const char *p, const char *end, unsigned int *method,
+                  const char **url, const char **url_end,
+                  unsigned short *http_major, unsigned short *http_minor)
+{
+  enum state s = s_req_spaces_before_url;
+  unsigned int index;
+
+  for (index = 1, p++; ; index++, p++) {
+    if (p == end || *p == '\0') {
+      return NULL;
+    }
+    if (*p == ' ' && method_strings[*method][index] == '\0') {
+      break;
+    }
+    if (!match_method_char(method, index, *p)) {
+      return NULL;
+    }
+  }
+
+  if (*method == HTTP_CONNECT) {
+    return NULL;
+  }
+
+  while (p != end && *p == ' ') {
+    p++;
+  }
+
+  *url = p;
+  for (; p != end && *p != ' '; p++) {
+    s = parse_url_char(s, *p);
+    if (s == s_dead) {
+      return NULL;
+    }
+  }
+
+  switch (s) {
+    case s_req_server:
+    case s_req_server_with_at:
+    case s_req_path:
+    case s_req_query_string_start:
+    case s_req_query_string:
+    case s_req_fragment_start:
+    case s_req_fragment:
+      break;
+
+    default:
+      return NULL;
+  }
+
+  *url_end = p;
+  while (p != end && *p == ' ') {
+    p++;
+  }
+
+  if (end - p < 9 || memcmp(p, "HTTP/", 5) != 0 ||
+      !IS_NUM(p[5]) || p[6] != '.' || !IS_NUM(p[7])) {
+    return NULL;
+  }
+
+  *http_major = p[5] - '0';
+  *http_minor = p[7] - '0';
+  p += 8;
+
+  if (*p == CR && ++p == end) {
+    return NULL;
+  }
+
+  return *p == LF ? p : NULL;
+}
+
+/* Status line with a three digit status code, starting at its 'H' */
+static const char *
+fast_status_line(const char *p, const char *end,
+                 unsigned short *http_major, unsigned short *http_minor,
+                 unsigned int *status_code,
+                 const char **status, const char **status_end)
+{
+  if (end - p < 14 || memcmp(p, "HTTP/", 5) != 0 ||
+      !IS_NUM(p[5]) || p[6] != '.' || !IS_NUM(p[7]) || p[8] != ' ' ||
+      !IS_NUM(p[9]) || !IS_NUM(p[10]) || !IS_NUM(p[11]) || p[12] != ' ') {
+    return NULL;
+  }
+
+  *http_major = p[5] - '0';
+  *http_minor = p[7] - '0';
+  *status_code = (p[9] - '0') * 100 + (p[10] - '0') * 10 + (p[11] - '0');
+
+  p += 13;
+  *status = p;
+  for (; p != end; p++) {
+    p = scan_header_value(p, end);
+    if (p == end || *p == CR || *p == LF) {
+      break;
+    }
+  }
+
+  if (p == end) {
+    return NULL;
+  }
+
+  *status_end = p;
+  if (*p == CR && (++p == end || *p != LF)) {
+    return NULL;
+  }
+
+  return p;
+}
+
+/* Header line whose field name does not need any special handling. The
+ * byte after the line must be in the buffer too, to rule out obsolete line
+ * folding.
+ */
+static const char *
+fast_header_line(const char *p, const char *end, unsigned int lenient,
+                 const char **colon, const char **value, const char **value_end)
+{
+  const char *name = p;
+  size_t name_len;
+
+  while (p != end && TOKEN(*p)) {
+    p++;
+  }
+
+  if (p == end || *p != ':') {
+    return NULL;
+  }
+
+  /* The matcher in s_header_field allows trailing spaces after a name */
+  for (name_len = p - name; name_len > 0 && name[name_len - 1] == ' ';) {
+    name_len--;
+  }
+
+  /* Leave the names it acts on to s_header_field */
+  if (name_len < 32 && (HEADER_NAME_LENGTHS >> name_len & 1) &&
+      header_name_state(name, name_len) != h_general) {
+    return NULL;
+  }
+
+  /* s_header_field marks the message as using Transfer-Encoding as soon as
+   * the name starts with it (17 bytes), even if more bytes follow
+   */
+  if (name_len > 17 && header_name_state(name, 17) == h_transfer_encoding) {
+    return NULL;
+  }
+
+  *colon = p++;
+  while (p != end && (*p == ' ' || *p == '\t')) {
+    p++;
+  }
+
+  if (p == end || *p == CR || *p == LF) {
+    return NULL;
+  }
+
+  /* Like s_header_value_start, don't check the first byte of the value */
+  *value = p++;
+  for (; p != end; p++) {
+    p = scan_header_value(p, end);
+    if (p == end || *p == CR || *p == LF) {
+      break;
+    }
+    if (!lenient) {
+      return NULL;
+    }
+  }
+
+  if (p == end) {
+    return NULL;
+  }
+
+  *value_end = p;
+  if (*p == CR && (++p == end || *p != LF)) {
+    return NULL;
+  }
+
+  if (p + 1 == end || p[1] == ' ' || p[1] == '\t') {
+    return NULL;
+  }
+
+  return p;
+}
+
+
 size_t http_parser_execute (http_parser *parser,
                             const http_parser_settings *settings,
                             const char *data,
                             size_t len)
+{
+  return http_parser_execute_budget(parser, settings, data, len, 0, 0);
+}
+
+
+size_t http_parser_execute_budget (http_parser *parser,
+                                   const http_parser_settings *settings,
+                                   const char *data,
+                                   size_t len,
+                                   size_t max_bytes,
+                                   size_t max_messages)
 {
   char c, ch;
   int8_t unhex_val;
@@ -654,8 +1180,96 @@ size_t http_parser_execute (http_parser *parser,
   enum state p_state = (enum state) parser->state;
   const unsigned int lenient = parser->lenient_http_headers;
   const unsigned int allow_chunked_length = parser->allow_chunked_length;
+  const unsigned int on_header = (settings->on_header != NULL);
+
+  /* on_header only: the current header line, and what it may change in the
+   * parser, so that it can be handed back if the data ends inside it
+   */
+  const char *header_line_mark = 0;
+  const char *header_field_end = 0;
+  const char *header_value_end = 0;
+  const struct http_header_filter *header_filter =
+    on_header ? settings->header_filter : NULL;
+  unsigned int header_line_skip = 0;
+  unsigned int header_line_flags = 0;
+  unsigned int header_line_uses_te = 0;
+  uint64_t header_line_content_length = 0;
+  uint32_t header_line_nread = 0;
 
   uint32_t nread = parser->nread;
+  size_t nmessages = 0;
+  const char *span_start = NULL;
+  const char *loop_end = data + len;
+
+#if HTTP_PARSER_COMPUTED_GOTO
+  static const void *const dispatch_table[] =
+    { [0] = &&L_s_invalid
+    , STATE_LABEL(s_dead)
+    , STATE_LABEL(s_start_req_or_res)
+    , STATE_LABEL(s_res_or_resp_H)
+    , STATE_LABEL(s_start_res)
+    , STATE_LABEL(s_res_H)
+    , STATE_LABEL(s_res_HT)
+    , STATE_LABEL(s_res_HTT)
+    , STATE_LABEL(s_res_HTTP)
+    , STATE_LABEL(s_res_http_major)
+    , STATE_LABEL(s_res_http_dot)
+    , STATE_LABEL(s_res_http_minor)
+    , STATE_LABEL(s_res_http_end)
+    , STATE_LABEL(s_res_first_status_code)
+    , STATE_LABEL(s_res_status_code)
+    , STATE_LABEL(s_res_status_start)
+    , STATE_LABEL(s_res_status)
+    , STATE_LABEL(s_res_line_almost_done)
+    , STATE_LABEL(s_start_req)
+    , STATE_LABEL(s_req_method)
+    , STATE_LABEL(s_req_spaces_before_url)
+    , STATE_LABEL(s_req_schema)
+    , STATE_LABEL(s_req_schema_slash)
+    , STATE_LABEL(s_req_schema_slash_slash)
+    , STATE_LABEL(s_req_server_start)
+    , STATE_LABEL(s_req_server)
+    , STATE_LABEL(s_req_server_with_at)
+    , STATE_LABEL(s_req_path)
+    , STATE_LABEL(s_req_query_string_start)
+    , STATE_LABEL(s_req_query_string)
+    , STATE_LABEL(s_req_fragment_start)
+    , STATE_LABEL(s_req_fragment)
+    , STATE_LABEL(s_req_http_start)
+    , STATE_LABEL(s_req_http_H)
+    , STATE_LABEL(s_req_http_HT)
+    , STATE_LABEL(s_req_http_HTT)
+    , STATE_LABEL(s_req_http_HTTP)
+    , STATE_LABEL(s_req_http_I)
+    , STATE_LABEL(s_req_http_IC)
+    , STATE_LABEL(s_req_http_major)
+    , STATE_LABEL(s_req_http_dot)
+    , STATE_LABEL(s_req_http_minor)
+    , STATE_LABEL(s_req_http_end)
+    , STATE_LABEL(s_req_line_almost_done)
+    , STATE_LABEL(s_header_field_start)
+    , STATE_LABEL(s_header_field)
+    , STATE_LABEL(s_header_value_discard_ws)
+    , STATE_LABEL(s_header_value_discard_ws_almost_done)
+    , STATE_LABEL(s_header_value_discard_lws)
+    , STATE_LABEL(s_header_value_start)
+    , STATE_LABEL(s_header_value)
+    , STATE_LABEL(s_header_value_lws)
+    , STATE_LABEL(s_header_almost_done)
+    , STATE_LABEL(s_chunk_size_start)
+    , STATE_LABEL(s_chunk_size)
+    , STATE_LABEL(s_chunk_parameters)
+    , STATE_LABEL(s_chunk_size_almost_done)
+    , STATE_LABEL(s_headers_almost_done)
+    , STATE_LABEL(s_headers_done)
+    , STATE_LABEL(s_chunk_data)
+    , STATE_LABEL(s_chunk_data_almost_done)
+    , STATE_LABEL(s_chunk_data_done)
+    , STATE_LABEL(s_body_identity)
+    , STATE_LABEL(s_body_identity_eof)
+    , STATE_LABEL(s_message_done)
+    };
+#endif
 
   /* We're in an error state. Don't bother doing anything. */
   if (HTTP_PARSER_ERRNO(parser) != HPE_OK) {
@@ -683,6 +1297,11 @@ size_t http_parser_execute (http_parser *parser,
     }
   }
 
+  if (max_bytes != 0 && len > max_bytes) {
+    len = max_bytes;
+    loop_end = data + len;
+  }
+
 
   if (CURRENT_STATE() == s_header_field)
     header_field_mark = data;
@@ -709,16 +1328,23 @@ size_t http_parser_execute (http_parser *parser,
     break;
   }
 
-  for (p=data; p != data + len; p++) {
-    ch = *p;
+#if HTTP_PARSER_COMPUTED_GOTO
+  /* Let the switch's default case deal with states the table doesn't cover */
+  if (UNLIKELY(CURRENT_STATE() > s_message_done)) {
+    UPDATE_STATE(0);
+  }
+#endif
+
+  START_HEADER_SPAN(nread, data);
 
-    if (PARSING_HEADER(CURRENT_STATE()))
-      COUNT_HEADER_SIZE(1);
+  for (p=data; p != loop_end; p++) {
+    ch = *p;
 
 reexecute:
+    DISPATCH();
     switch (CURRENT_STATE()) {
 
-      case s_dead:
+      STATE_CASE(s_dead):
         /* this state is used after a 'Connection: close' message
          * the parser will error out if it reads another message
          */
@@ -728,7 +1354,7 @@ reexecute:
         SET_ERRNO(HPE_CLOSED_CONNECTION);
         goto error;
 
-      case s_start_req_or_res:
+      STATE_CASE(s_start_req_or_res):
       {
         if (ch == CR || ch == LF)
           break;
@@ -749,7 +1375,7 @@ reexecute:
         break;
       }
 
-      case s_res_or_resp_H:
+      STATE_CASE(s_res_or_resp_H):
         if (ch == 'T') {
           parser->type = HTTP_RESPONSE;
           UPDATE_STATE(s_res_HT);
@@ -766,7 +1392,7 @@ reexecute:
         }
         break;
 
-      case s_start_res:
+      STATE_CASE(s_start_res):
       {
         if (ch == CR || ch == LF)
           break;
@@ -782,30 +1408,59 @@ reexecute:
         }
 
         CALLBACK_NOTIFY(message_begin);
+
+        {
+          unsigned short http_major, http_minor;
+          unsigned int status_code;
+          const char *status, *status_end, *lf;
+
+          lf = fast_status_line(p, loop_end, &http_major, &http_minor,
+                                &status_code, &status, &status_end);
+          if (lf != NULL) {
+            COUNT_HEADER_LINE(lf);
+            parser->http_major = http_major;
+            parser->http_minor = http_minor;
+            parser->status_code = status_code;
+
+            status_mark = status;
+            p = status_end;
+            UPDATE_STATE(s_res_line_almost_done);
+            if (*p == CR) {
+              CALLBACK_DATA(status);
+            } else {
+              CALLBACK_DATA_NOADVANCE(status);
+            }
+
+            p = lf;
+            UPDATE_STATE(s_header_field_start);
+            START_HEADER_SPAN(nread, p + 1);
+            CALLBACK_NOTIFY(status_line_complete);
+          }
+        }
         break;
       }
 
-      case s_res_H:
+      STATE_CASE(s_res_H):
         STRICT_CHECK(ch != 'T');
         UPDATE_STATE(s_res_HT);
         break;
 
-      case s_res_HT:
+      STATE_CASE(s_res_HT):
         STRICT_CHECK(ch != 'T');
         UPDATE_STATE(s_res_HTT);
         break;
 
-      case s_res_HTT:
+      STATE_CASE(s_res_HTT):
         STRICT_CHECK(ch != 'P');
         UPDATE_STATE(s_res_HTTP);
         break;
 
-      case s_res_HTTP:
+      STATE_CASE(s_res_HTTP):
         STRICT_CHECK(ch != '/');
         UPDATE_STATE(s_res_http_major);
         break;
 
-      case s_res_http_major:
+      STATE_CASE(s_res_http_major):
         if (UNLIKELY(!IS_NUM(ch))) {
           SET_ERRNO(HPE_INVALID_VERSION);
           goto error;
@@ -815,7 +1470,7 @@ reexecute:
         UPDATE_STATE(s_res_http_dot);
         break;
 
-      case s_res_http_dot:
+      STATE_CASE(s_res_http_dot):
       {
         if (UNLIKELY(ch != '.')) {
           SET_ERRNO(HPE_INVALID_VERSION);
@@ -826,7 +1481,7 @@ reexecute:
         break;
       }
 
-      case s_res_http_minor:
+      STATE_CASE(s_res_http_minor):
         if (UNLIKELY(!IS_NUM(ch))) {
           SET_ERRNO(HPE_INVALID_VERSION);
           goto error;
@@ -836,7 +1491,7 @@ reexecute:
         UPDATE_STATE(s_res_http_end);
         break;
 
-      case s_res_http_end:
+      STATE_CASE(s_res_http_end):
       {
         if (UNLIKELY(ch != ' ')) {
           SET_ERRNO(HPE_INVALID_VERSION);
@@ -847,7 +1502,7 @@ reexecute:
         break;
       }
 
-      case s_res_first_status_code:
+      STATE_CASE(s_res_first_status_code):
       {
         if (!IS_NUM(ch)) {
           if (ch == ' ') {
@@ -862,7 +1517,7 @@ reexecute:
         break;
       }
 
-      case s_res_status_code:
+      STATE_CASE(s_res_status_code):
       {
         if (!IS_NUM(ch)) {
           switch (ch) {
@@ -892,7 +1547,7 @@ reexecute:
         break;
       }
 
-      case s_res_status_start:
+      STATE_CASE(s_res_status_start):
       {
         MARK(status);
         UPDATE_STATE(s_res_status);
@@ -904,7 +1559,7 @@ reexecute:
         break;
       }
 
-      case s_res_status:
+      STATE_CASE(s_res_status):
         if (ch == CR) {
           UPDATE_STATE(s_res_line_almost_done);
           CALLBACK_DATA(status);
@@ -912,19 +1567,21 @@ reexecute:
         }
 
         if (ch == LF) {
-          UPDATE_STATE(s_header_field_start);
-          CALLBACK_DATA(status);
-          break;
+          /* Let s_res_line_almost_done run the line complete callback */
+          UPDATE_STATE(s_res_line_almost_done);
+          CALLBACK_DATA_NOADVANCE(status);
+          REEXECUTE();
         }
 
         break;
 
-      case s_res_line_almost_done:
+      STATE_CASE(s_res_line_almost_done):
         STRICT_CHECK(ch != LF);
         UPDATE_STATE(s_header_field_start);
+        CALLBACK_NOTIFY(status_line_complete);
         break;
 
-      case s_start_req:
+      STATE_CASE(s_start_req):
       {
         if (ch == CR || ch == LF)
           break;
@@ -939,89 +1596,67 @@ reexecute:
 
         parser->method = (enum http_method) 0;
         parser->index = 1;
-        switch (ch) {
-          case 'A': parser->method = HTTP_ACL; break;
-          case 'B': parser->method = HTTP_BIND; break;
-          case 'C': parser->method = HTTP_CONNECT; /* or COPY, CHECKOUT */ break;
-          case 'D': parser->method = HTTP_DELETE; break;
-          case 'G': parser->method = HTTP_GET; break;
-          case 'H': parser->method = HTTP_HEAD; break;
-          case 'L': parser->method = HTTP_LOCK; /* or LINK */ break;
-          case 'M': parser->method = HTTP_MKCOL; /* or MOVE, MKACTIVITY, MERGE, M-SEARCH, MKCALENDAR */ break;
-          case 'N': parser->method = HTTP_NOTIFY; break;
-          case 'O': parser->method = HTTP_OPTIONS; break;
-          case 'P': parser->method = HTTP_POST;
-            /* or PROPFIND|PROPPATCH|PUT|PATCH|PURGE */
-            break;
-          case 'R': parser->method = HTTP_REPORT; /* or REBIND */ break;
-          case 'S': parser->method = HTTP_SUBSCRIBE; /* or SEARCH, SOURCE */ break;
-          case 'T': parser->method = HTTP_TRACE; break;
-          case 'U': parser->method = HTTP_UNLOCK; /* or UNSUBSCRIBE, UNBIND, UNLINK */ break;
-          default:
+        {
+          unsigned int method;
+
+          if (UNLIKELY(!match_method_start(&method, ch))) {
             SET_ERRNO(HPE_INVALID_METHOD);
             goto error;
+          }
+          parser->method = method;
         }
         UPDATE_STATE(s_req_method);
 
         CALLBACK_NOTIFY(message_begin);
 
+        {
+          unsigned int method = parser->method;
+          unsigned short http_major, http_minor;
+          const char *url, *url_end, *lf;
+
+          lf = fast_request_line(p, loop_end, &method, &url, &url_end,
+                                 &http_major, &http_minor);
+          if (lf != NULL) {
+            COUNT_HEADER_LINE(lf);
+            parser->method = method;
+
+            url_mark = url;
+            p = url_end;
+            UPDATE_STATE(s_req_http_start);
+            CALLBACK_DATA(url);
+
+            parser->http_major = http_major;
+            parser->http_minor = http_minor;
+            p = lf;
+            UPDATE_STATE(s_header_field_start);
+            START_HEADER_SPAN(nread, p + 1);
+            CALLBACK_NOTIFY(request_line_complete);
+          }
+        }
         break;
       }
 
-      case s_req_method:
+      STATE_CASE(s_req_method):
       {
-        const char *matcher;
+        unsigned int method = parser->method;
         if (UNLIKELY(ch == '\0')) {
           SET_ERRNO(HPE_INVALID_METHOD);
           goto error;
         }
 
-        matcher = method_strings[parser->method];
-        if (ch == ' ' && matcher[parser->index] == '\0') {
+        if (ch == ' ' && method_strings[method][parser->index] == '\0') {
           UPDATE_STATE(s_req_spaces_before_url);
-        } else if (ch == matcher[parser->index]) {
-          ; /* nada */
-        } else if ((ch >= 'A' && ch <= 'Z') || ch == '-') {
-
-          switch (parser->method << 16 | parser->index << 8 | ch) {
-#define XX(meth, pos, ch, new_meth) \
-            case (HTTP_##meth << 16 | pos << 8 | ch): \
-              parser->method = HTTP_##new_meth; break;
-
-            XX(POST,      1, 'U', PUT)
-            XX(POST,      1, 'A', PATCH)
-            XX(POST,      1, 'R', PROPFIND)
-            XX(PUT,       2, 'R', PURGE)
-            XX(CONNECT,   1, 'H', CHECKOUT)
-            XX(CONNECT,   2, 'P', COPY)
-            XX(MKCOL,     1, 'O', MOVE)
-            XX(MKCOL,     1, 'E', MERGE)
-            XX(MKCOL,     1, '-', MSEARCH)
-            XX(MKCOL,     2, 'A', MKACTIVITY)
-            XX(MKCOL,     3, 'A', MKCALENDAR)
-            XX(SUBSCRIBE, 1, 'E', SEARCH)
-            XX(SUBSCRIBE, 1, 'O', SOURCE)
-            XX(REPORT,    2, 'B', REBIND)
-            XX(PROPFIND,  4, 'P', PROPPATCH)
-            XX(LOCK,      1, 'I', LINK)
-            XX(UNLOCK,    2, 'S', UNSUBSCRIBE)
-            XX(UNLOCK,    2, 'B', UNBIND)
-            XX(UNLOCK,    3, 'I', UNLINK)
-#undef XX
-            default:
-              SET_ERRNO(HPE_INVALID_METHOD);
-              goto error;
-          }
-        } else {
+        } else if (UNLIKELY(!match_method_char(&method, parser->index, ch))) {
           SET_ERRNO(HPE_INVALID_METHOD);
           goto error;
         }
 
+        parser->method = method;
         ++parser->index;
         break;
       }
 
-      case s_req_spaces_before_url:
+      STATE_CASE(s_req_spaces_before_url):
       {
         if (ch == ' ') break;
 
@@ -1039,10 +1674,10 @@ reexecute:
         break;
       }
 
-      case s_req_schema:
-      case s_req_schema_slash:
-      case s_req_schema_slash_slash:
-      case s_req_server_start:
+      STATE_CASE(s_req_schema):
+      STATE_CASE(s_req_schema_slash):
+      STATE_CASE(s_req_schema_slash_slash):
+      STATE_CASE(s_req_server_start):
       {
         switch (ch) {
           /* No whitespace allowed here */
@@ -1062,13 +1697,13 @@ reexecute:
         break;
       }
 
-      case s_req_server:
-      case s_req_server_with_at:
-      case s_req_path:
-      case s_req_query_string_start:
-      case s_req_query_string:
-      case s_req_fragment_start:
-      case s_req_fragment:
+      STATE_CASE(s_req_server):
+      STATE_CASE(s_req_server_with_at):
+      STATE_CASE(s_req_path):
+      STATE_CASE(s_req_query_string_start):
+      STATE_CASE(s_req_query_string):
+      STATE_CASE(s_req_fragment_start):
+      STATE_CASE(s_req_fragment):
       {
         switch (ch) {
           case ' ':
@@ -1079,11 +1714,15 @@ reexecute:
           case LF:
             parser->http_major = 0;
             parser->http_minor = 9;
-            UPDATE_STATE((ch == CR) ?
-              s_req_line_almost_done :
-              s_header_field_start);
-            CALLBACK_DATA(url);
-            break;
+            UPDATE_STATE(s_req_line_almost_done);
+            if (ch == CR) {
+              CALLBACK_DATA(url);
+              break;
+            }
+
+            /* Let s_req_line_almost_done run the line complete callback */
+            CALLBACK_DATA_NOADVANCE(url);
+            REEXECUTE();
           default:
             UPDATE_STATE(parse_url_char(CURRENT_STATE(), ch));
             if (UNLIKELY(CURRENT_STATE() == s_dead)) {
@@ -1094,7 +1733,7 @@ reexecute:
         break;
       }
 
-      case s_req_http_start:
+      STATE_CASE(s_req_http_start):
         switch (ch) {
           case ' ':
             break;
@@ -1113,37 +1752,37 @@ reexecute:
         }
         break;
 
-      case s_req_http_H:
+      STATE_CASE(s_req_http_H):
         STRICT_CHECK(ch != 'T');
         UPDATE_STATE(s_req_http_HT);
         break;
 
-      case s_req_http_HT:
+      STATE_CASE(s_req_http_HT):
         STRICT_CHECK(ch != 'T');
         UPDATE_STATE(s_req_http_HTT);
         break;
 
-      case s_req_http_HTT:
+      STATE_CASE(s_req_http_HTT):
         STRICT_CHECK(ch != 'P');
         UPDATE_STATE(s_req_http_HTTP);
         break;
 
-      case s_req_http_I:
+      STATE_CASE(s_req_http_I):
         STRICT_CHECK(ch != 'C');
         UPDATE_STATE(s_req_http_IC);
         break;
 
-      case s_req_http_IC:
+      STATE_CASE(s_req_http_IC):
         STRICT_CHECK(ch != 'E');
         UPDATE_STATE(s_req_http_HTTP);  /* Treat "ICE" as "HTTP". */
         break;
 
-      case s_req_http_HTTP:
+      STATE_CASE(s_req_http_HTTP):
         STRICT_CHECK(ch != '/');
         UPDATE_STATE(s_req_http_major);
         break;
 
-      case s_req_http_major:
+      STATE_CASE(s_req_http_major):
         if (UNLIKELY(!IS_NUM(ch))) {
           SET_ERRNO(HPE_INVALID_VERSION);
           goto error;
@@ -1153,7 +1792,7 @@ reexecute:
         UPDATE_STATE(s_req_http_dot);
         break;
 
-      case s_req_http_dot:
+      STATE_CASE(s_req_http_dot):
       {
         if (UNLIKELY(ch != '.')) {
           SET_ERRNO(HPE_INVALID_VERSION);
@@ -1164,7 +1803,7 @@ reexecute:
         break;
       }
 
-      case s_req_http_minor:
+      STATE_CASE(s_req_http_minor):
         if (UNLIKELY(!IS_NUM(ch))) {
           SET_ERRNO(HPE_INVALID_VERSION);
           goto error;
@@ -1174,7 +1813,7 @@ reexecute:
         UPDATE_STATE(s_req_http_end);
         break;
 
-      case s_req_http_end:
+      STATE_CASE(s_req_http_end):
       {
         if (ch == CR) {
           UPDATE_STATE(s_req_line_almost_done);
@@ -1183,6 +1822,7 @@ reexecute:
 
         if (ch == LF) {
           UPDATE_STATE(s_header_field_start);
+          CALLBACK_NOTIFY(request_line_complete);
           break;
         }
 
@@ -1192,7 +1832,7 @@ reexecute:
       }
 
       /* end of request line */
-      case s_req_line_almost_done:
+      STATE_CASE(s_req_line_almost_done):
       {
         if (UNLIKELY(ch != LF)) {
           SET_ERRNO(HPE_LF_EXPECTED);
@@ -1200,10 +1840,11 @@ reexecute:
         }
 
         UPDATE_STATE(s_header_field_start);
+        CALLBACK_NOTIFY(request_line_complete);
         break;
       }
 
-      case s_header_field_start:
+      STATE_CASE(s_header_field_start):
       {
         if (ch == CR) {
           UPDATE_STATE(s_headers_almost_done);
@@ -1224,39 +1865,60 @@ reexecute:
           goto error;
         }
 
-        MARK(header_field);
+        if (!on_header) {
+          const char *colon, *value, *value_end, *lf;
 
-        parser->index = 0;
-        UPDATE_STATE(s_header_field);
+          lf = fast_header_line(p, loop_end, lenient,
+                                &colon, &value, &value_end);
+          if (lf != NULL) {
+            COUNT_HEADER_LINE(lf);
+            parser->header_state = h_general;
 
-        switch (c) {
-          case 'c':
-            parser->header_state = h_C;
-            break;
+            header_field_mark = p;
+            p = colon;
+            UPDATE_STATE(s_header_value_discard_ws);
+            CALLBACK_DATA(header_field);
 
-          case 'p':
-            parser->header_state = h_matching_proxy_connection;
-            break;
+            header_value_mark = value;
+            p = value_end;
+            UPDATE_STATE(s_header_almost_done);
+            if (*p == CR) {
+              CALLBACK_DATA(header_value);
+            } else {
+              CALLBACK_DATA_NOADVANCE(header_value);
+            }
 
-          case 't':
-            parser->header_state = h_matching_transfer_encoding;
+            /* The next byte was checked not to fold this line */
+            p = lf;
+            UPDATE_STATE(s_header_field_start);
+            START_HEADER_SPAN(nread, p + 1);
             break;
+          }
+        }
 
-          case 'u':
-            parser->header_state = h_matching_upgrade;
-            break;
+        MARK(header_field);
 
-          default:
-            parser->header_state = h_general;
-            break;
+        if (on_header) {
+          header_line_mark = p;
+          header_line_flags = parser->flags;
+          header_line_uses_te = parser->uses_transfer_encoding;
+          header_line_content_length = parser->content_length;
+          header_line_nread = HEADER_NREAD() - 1;
+        }
+
+        parser->index = 0;
+        UPDATE_STATE(s_header_field);
+
+        parser->header_state = HEADER_NAME_NEXT(h_name_first, c);
+        if (parser->header_state == h_transfer_encoding) {
+          parser->uses_transfer_encoding = 1;
         }
         break;
       }
 
-      case s_header_field:
+      STATE_CASE(s_header_field):
       {
-        const char* start = p;
-        for (; p != data + len; p++) {
+        for (; p != loop_end; p++) {
           ch = *p;
           c = TOKEN(ch);
 
@@ -1265,123 +1927,58 @@ reexecute:
 
           switch (parser->header_state) {
             case h_general: {
-              size_t left = data + len - p;
-              const char* pe = p + MIN(left, max_header_size);
-              while (p+1 < pe && TOKEN(p[1])) {
+              while (p+1 < loop_end && TOKEN(p[1])) {
                 p++;
               }
               break;
             }
 
-            case h_C:
-              parser->index++;
-              parser->header_state = (c == 'o' ? h_CO : h_general);
+            case h_connection:
+            case h_content_length:
+            case h_transfer_encoding:
+            case h_upgrade:
+              if (ch != ' ') parser->header_state = h_general;
               break;
 
-            case h_CO:
-              parser->index++;
-              parser->header_state = (c == 'n' ? h_CON : h_general);
-              break;
+            default: {
+              unsigned int h_state = parser->header_state;
 
-            case h_CON:
-              parser->index++;
-              switch (c) {
-                case 'n':
-                  parser->header_state = h_matching_connection;
-                  break;
-                case 't':
-                  parser->header_state = h_matching_content_length;
-                  break;
-                default:
-                  parser->header_state = h_general;
+              assert(h_state >= h_name_first && h_state <= h_name_last);
+              for (;;) {
+                h_state = HEADER_NAME_NEXT(h_state, c);
+                if (h_state < h_name_first || h_state > h_name_last ||
+                    p + 1 == loop_end || !(c = TOKEN(p[1]))) {
                   break;
+                }
+                p++;
               }
-              break;
-
-            /* connection */
-
-            case h_matching_connection:
-              parser->index++;
-              if (parser->index > sizeof(CONNECTION)-1
-                  || c != CONNECTION[parser->index]) {
-                parser->header_state = h_general;
-              } else if (parser->index == sizeof(CONNECTION)-2) {
-                parser->header_state = h_connection;
-              }
-              break;
-
-            /* proxy-connection */
-
-            case h_matching_proxy_connection:
-              parser->index++;
-              if (parser->index > sizeof(PROXY_CONNECTION)-1
-                  || c != PROXY_CONNECTION[parser->index]) {
-                parser->header_state = h_general;
-              } else if (parser->index == sizeof(PROXY_CONNECTION)-2) {
-                parser->header_state = h_connection;
-              }
-              break;
-
-            /* content-length */
-
-            case h_matching_content_length:
-              parser->index++;
-              if (parser->index > sizeof(CONTENT_LENGTH)-1
-                  || c != CONTENT_LENGTH[parser->index]) {
-                parser->header_state = h_general;
-              } else if (parser->index == sizeof(CONTENT_LENGTH)-2) {
-                parser->header_state = h_content_length;
-              }
-              break;
 
-            /* transfer-encoding */
-
-            case h_matching_transfer_encoding:
-              parser->index++;
-              if (parser->index > sizeof(TRANSFER_ENCODING)-1
-                  || c != TRANSFER_ENCODING[parser->index]) {
-                parser->header_state = h_general;
-              } else if (parser->index == sizeof(TRANSFER_ENCODING)-2) {
-                parser->header_state = h_transfer_encoding;
+              parser->header_state = h_state;
+              if (h_state == h_transfer_encoding) {
                 parser->uses_transfer_encoding = 1;
               }
               break;
-
-            /* upgrade */
-
-            case h_matching_upgrade:
-              parser->index++;
-              if (parser->index > sizeof(UPGRADE)-1
-                  || c != UPGRADE[parser->index]) {
-                parser->header_state = h_general;
-              } else if (parser->index == sizeof(UPGRADE)-2) {
-                parser->header_state = h_upgrade;
-              }
-              break;
-
-            case h_connection:
-            case h_content_length:
-            case h_transfer_encoding:
-            case h_upgrade:
-              if (ch != ' ') parser->header_state = h_general;
-              break;
-
-            default:
-              assert(0 && "Unknown header_state");
-              break;
+            }
           }
         }
 
-        if (p == data + len) {
+        if (p == loop_end) {
           --p;
-          COUNT_HEADER_SIZE(p - start);
           break;
         }
 
-        COUNT_HEADER_SIZE(p - start);
-
         if (ch == ':') {
           UPDATE_STATE(s_header_value_discard_ws);
+          if (on_header) {
+            header_field_end = p;
+            if (header_filter != NULL &&
+                !http_header_filter_match(header_filter,
+                                          header_field_mark,
+                                          p - header_field_mark)) {
+              header_line_skip = 1;
+            }
+            break;
+          }
           CALLBACK_DATA(header_field);
           break;
         }
@@ -1390,7 +1987,7 @@ reexecute:
         goto error;
       }
 
-      case s_header_value_discard_ws:
+      STATE_CASE(s_header_value_discard_ws):
         if (ch == ' ' || ch == '\t') break;
 
         if (ch == CR) {
@@ -1405,7 +2002,13 @@ reexecute:
 
         /* fall through */
 
+      /* Spelled out rather than STATE_CASE() so that GCC's fall through
+       * detection sees a plain case label after the comment
+       */
       case s_header_value_start:
+#if HTTP_PARSER_COMPUTED_GOTO
+      L_s_header_value_start:
+#endif
       {
         MARK(header_value);
 
@@ -1479,23 +2082,29 @@ reexecute:
         break;
       }
 
-      case s_header_value:
+      STATE_CASE(s_header_value):
       {
-        const char* start = p;
         enum header_states h_state = (enum header_states) parser->header_state;
-        for (; p != data + len; p++) {
+        for (; p != loop_end; p++) {
           ch = *p;
           if (ch == CR) {
             UPDATE_STATE(s_header_almost_done);
             parser->header_state = h_state;
+            if (on_header) {
+              header_value_end = p;
+              break;
+            }
             CALLBACK_DATA(header_value);
             break;
           }
 
           if (ch == LF) {
             UPDATE_STATE(s_header_almost_done);
-            COUNT_HEADER_SIZE(p - start);
             parser->header_state = h_state;
+            if (on_header) {
+              header_value_end = p;
+              REEXECUTE();
+            }
             CALLBACK_DATA_NOADVANCE(header_value);
             REEXECUTE();
           }
@@ -1510,21 +2119,22 @@ reexecute:
           switch (h_state) {
             case h_general:
               {
-                size_t left = data + len - p;
-                const char* pe = p + MIN(left, max_header_size);
-
-                for (; p != pe; p++) {
+                for (; p != loop_end; p++) {
+                  p = scan_header_value(p, loop_end);
+                  if (p == loop_end) {
+                    break;
+                  }
                   ch = *p;
                   if (ch == CR || ch == LF) {
                     --p;
                     break;
                   }
-                  if (!lenient && !IS_HEADER_CHAR(ch)) {
+                  if (!lenient) {
                     SET_ERRNO(HPE_INVALID_HEADER_TOKEN);
                     goto error;
                   }
                 }
-                if (p == data + len)
+                if (p == loop_end)
                   --p;
                 break;
               }
@@ -1698,14 +2308,13 @@ reexecute:
         }
         parser->header_state = h_state;
 
-        if (p == data + len)
+        if (p == loop_end)
           --p;
 
-        COUNT_HEADER_SIZE(p - start);
         break;
       }
 
-      case s_header_almost_done:
+      STATE_CASE(s_header_almost_done):
       {
         if (UNLIKELY(ch != LF)) {
           SET_ERRNO(HPE_LF_EXPECTED);
@@ -1716,7 +2325,7 @@ reexecute:
         break;
       }
 
-      case s_header_value_lws:
+      STATE_CASE(s_header_value_lws):
       {
         if (ch == ' ' || ch == '\t') {
           if (parser->header_state == h_content_length_num) {
@@ -1746,17 +2355,20 @@ reexecute:
         }
 
         UPDATE_STATE(s_header_field_start);
+        if (on_header) {
+          CALLBACK_HEADER_NOADVANCE();
+        }
         REEXECUTE();
       }
 
-      case s_header_value_discard_ws_almost_done:
+      STATE_CASE(s_header_value_discard_ws_almost_done):
       {
         STRICT_CHECK(ch != LF);
         UPDATE_STATE(s_header_value_discard_lws);
         break;
       }
 
-      case s_header_value_discard_lws:
+      STATE_CASE(s_header_value_discard_lws):
       {
         if (ch == ' ' || ch == '\t') {
           UPDATE_STATE(s_header_value_discard_ws);
@@ -1787,12 +2399,17 @@ reexecute:
           /* header value was empty */
           MARK(header_value);
           UPDATE_STATE(s_header_field_start);
+          if (on_header) {
+            header_value_end = p;
+            CALLBACK_HEADER_NOADVANCE();
+            REEXECUTE();
+          }
           CALLBACK_DATA_NOADVANCE(header_value);
           REEXECUTE();
         }
       }
 
-      case s_headers_almost_done:
+      STATE_CASE(s_headers_almost_done):
       {
         STRICT_CHECK(ch != LF);
 
@@ -1871,13 +2488,14 @@ reexecute:
         REEXECUTE();
       }
 
-      case s_headers_done:
+      STATE_CASE(s_headers_done):
       {
         int hasBody;
         STRICT_CHECK(ch != LF);
 
         parser->nread = 0;
         nread = 0;
+        span_start = NULL;
 
         hasBody = parser->flags & F_CHUNKED ||
           (parser->content_length > 0 && parser->content_length != ULLONG_MAX);
@@ -1892,6 +2510,7 @@ reexecute:
         if (parser->flags & F_SKIPBODY) {
           UPDATE_STATE(NEW_MESSAGE());
           CALLBACK_NOTIFY(message_complete);
+          MESSAGE_BUDGET((p - data) + 1);
         } else if (parser->flags & F_CHUNKED) {
           /* chunked encoding - ignore Content-Length header,
            * prepare for a chunk */
@@ -1923,6 +2542,7 @@ reexecute:
             /* Content-Length header given but zero: Content-Length: 0\r\n */
             UPDATE_STATE(NEW_MESSAGE());
             CALLBACK_NOTIFY(message_complete);
+            MESSAGE_BUDGET((p - data) + 1);
           } else if (parser->content_length != ULLONG_MAX) {
             /* Content-Length header given and non-zero */
             UPDATE_STATE(s_body_identity);
@@ -1931,6 +2551,7 @@ reexecute:
               /* Assume content-length 0 - read the next */
               UPDATE_STATE(NEW_MESSAGE());
               CALLBACK_NOTIFY(message_complete);
+              MESSAGE_BUDGET((p - data) + 1);
             } else {
               /* Read body until EOF */
               UPDATE_STATE(s_body_identity_eof);
@@ -1938,10 +2559,11 @@ reexecute:
           }
         }
 
+        START_HEADER_SPAN(0, p + 1);
         break;
       }
 
-      case s_body_identity:
+      STATE_CASE(s_body_identity):
       {
         uint64_t to_read = MIN(parser->content_length,
                                (uint64_t) ((data + len) - p));
@@ -1978,24 +2600,26 @@ reexecute:
       }
 
       /* read until EOF */
-      case s_body_identity_eof:
+      STATE_CASE(s_body_identity_eof):
         MARK(body);
         p = data + len - 1;
 
         break;
 
-      case s_message_done:
+      STATE_CASE(s_message_done):
         UPDATE_STATE(NEW_MESSAGE());
+        START_HEADER_SPAN(HEADER_NREAD(), p + 1);
         CALLBACK_NOTIFY(message_complete);
         if (parser->upgrade) {
           /* Exit, the rest of the message is in a different protocol. */
           RETURN((p - data) + 1);
         }
+        MESSAGE_BUDGET((p - data) + 1);
         break;
 
-      case s_chunk_size_start:
+      STATE_CASE(s_chunk_size_start):
       {
-        assert(nread == 1);
+        assert(HEADER_NREAD() == 1);
         assert(parser->flags & F_CHUNKED);
 
         unhex_val = unhex[(unsigned char)ch];
@@ -2009,7 +2633,7 @@ reexecute:
         break;
       }
 
-      case s_chunk_size:
+      STATE_CASE(s_chunk_size):
       {
         uint64_t t;
 
@@ -2046,7 +2670,7 @@ reexecute:
         break;
       }
 
-      case s_chunk_parameters:
+      STATE_CASE(s_chunk_parameters):
       {
         assert(parser->flags & F_CHUNKED);
         /* just ignore this shit. TODO check for overflow */
@@ -2057,13 +2681,12 @@ reexecute:
         break;
       }
 
-      case s_chunk_size_almost_done:
+      STATE_CASE(s_chunk_size_almost_done):
       {
         assert(parser->flags & F_CHUNKED);
         STRICT_CHECK(ch != LF);
 
         parser->nread = 0;
-        nread = 0;
 
         if (parser->content_length == 0) {
           parser->flags |= F_TRAILING;
@@ -2071,11 +2694,12 @@ reexecute:
         } else {
           UPDATE_STATE(s_chunk_data);
         }
+        START_HEADER_SPAN(0, p + 1);
         CALLBACK_NOTIFY(chunk_header);
         break;
       }
 
-      case s_chunk_data:
+      STATE_CASE(s_chunk_data):
       {
         uint64_t to_read = MIN(parser->content_length,
                                (uint64_t) ((data + len) - p));
@@ -2098,7 +2722,7 @@ reexecute:
         break;
       }
 
-      case s_chunk_data_almost_done:
+      STATE_CASE(s_chunk_data_almost_done):
         assert(parser->flags & F_CHUNKED);
         assert(parser->content_length == 0);
         STRICT_CHECK(ch != CR);
@@ -2106,22 +2730,50 @@ reexecute:
         CALLBACK_DATA(body);
         break;
 
-      case s_chunk_data_done:
+      STATE_CASE(s_chunk_data_done):
         assert(parser->flags & F_CHUNKED);
         STRICT_CHECK(ch != LF);
         parser->nread = 0;
-        nread = 0;
         UPDATE_STATE(s_chunk_size_start);
+        START_HEADER_SPAN(0, p + 1);
         CALLBACK_NOTIFY(chunk_complete);
         break;
 
       default:
+#if HTTP_PARSER_COMPUTED_GOTO
+      L_s_invalid:
+#endif
         assert(0 && "unhandled state");
         SET_ERRNO(HPE_INVALID_INTERNAL_STATE);
         goto error;
     }
   }
 
+  /* The loop stopped short of the end of the data on the byte that takes
+   * the header size past max_header_size
+   */
+  if (p != data + len) {
+    SET_ERRNO(HPE_HEADER_OVERFLOW);
+    goto error;
+  }
+
+  if (span_start != NULL) {
+    nread += (uint32_t) (p - span_start);
+    span_start = NULL;
+  }
+
+  /* With on_header, hand an unfinished header line back to the caller and
+   * parse it again from its start on the next call.
+   */
+  if (header_line_mark) {
+    parser->flags = header_line_flags;
+    parser->uses_transfer_encoding = header_line_uses_te;
+    parser->content_length = header_line_content_length;
+    nread = header_line_nread;
+    UPDATE_STATE(s_header_field_start);
+    RETURN(header_line_mark - data);
+  }
+
   /* Run callbacks for any marks that we have leftover after we ran out of
    * bytes. There should be at most one of these set, so it's OK to invoke
    * them in series (unset marks will not result in callbacks).
@@ -2155,6 +2807,40 @@ error:
 }
 
 
+/* Connections ahead of the current one that http_parser_execute_batch()
+ * prefetches for; far enough to cover a miss, close enough that the lines
+ * are still in cache when they are used
+ */
+#define BATCH_PREFETCH_DISTANCE 2
+
+void
+http_parser_execute_batch (http_parser *const parsers[],
+                           const http_parser_settings *settings,
+                           const char *const bufs[],
+                           const size_t lens[],
+                           size_t nparsed[],
+                           size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    if (i + BATCH_PREFETCH_DISTANCE < n) {
+      size_t next = i + BATCH_PREFETCH_DISTANCE;
+
+      PREFETCH(parsers[next], 1);
+      if (lens[next] > 0) {
+        PREFETCH(bufs[next], 0);
+      }
+      if (lens[next] > 64) {
+        PREFETCH(bufs[next] + 64, 0);
+      }
+    }
+
+    nparsed[i] = http_parser_execute(parsers[i], settings, bufs[i], lens[i]);
+  }
+}
+
+
 /* Does the parser need to see an EOF to find the end of the message? */
 int
 http_message_needs_eof (const http_parser *parser)
@@ -2542,6 +3228,419 @@ http_parser_parse_url(const char *buf, size_t buflen, int is_connect,
   return 0;
 }
 
+/* Normalize `len` bytes of path in place; returns the new length.
+ *
+ * The output never grows, so it is written over the input as we go. When a
+ * ".." segment is found the previous output segment is dropped by moving
+ * `out` back; every byte is written and dropped at most once, which keeps
+ * this linear in `len`.
+ */
+static size_t
+normalize_path(char *path, size_t len, unsigned int flags)
+{
+  size_t in = 0;
+  size_t out = 0;
+  size_t seg;
+  int8_t hi;
+  int8_t lo;
+  char ch;
+
+  while (in < len) {
+    if (path[in] == '/') {
+      if ((flags & HTTP_PATH_MERGE_SLASHES) && out > 0 && path[out - 1] == '/') {
+        in++;
+        continue;
+      }
+
+      path[out++] = path[in++];
+      continue;
+    }
+
+    /* Copy one segment, decoding unreserved characters on the way */
+    seg = out;
+    for (; in < len && path[in] != '/'; in++) {
+      ch = path[in];
+
+      if ((flags & HTTP_PATH_DECODE_UNRESERVED) && ch == '%' && len - in > 2) {
+        hi = unhex[(unsigned char)path[in + 1]];
+        lo = unhex[(unsigned char)path[in + 2]];
+        if (hi != -1 && lo != -1 && IS_UNRESERVED((char) (hi << 4 | lo))) {
+          ch = (char) (hi << 4 | lo);
+          in += 2;
+        }
+      }
+
+      path[out++] = ch;
+    }
+
+    if ((flags & HTTP_PATH_REMOVE_DOT_SEGMENTS) == 0) {
+      continue;
+    }
+
+    if (out - seg == 1 && path[seg] == '.') {
+      out = seg;
+    } else if (out - seg == 2 && path[seg] == '.' && path[seg + 1] == '.') {
+      out = seg;
+
+      /* Drop the previous segment, but never the leading '/' */
+      if (seg >= 2) {
+        out = seg - 1;
+        while (out > 0 && path[out - 1] != '/') {
+          out--;
+        }
+      }
+    } else {
+      continue;
+    }
+
+    /* The '/' that terminated the dot segment is already in the output */
+    if (in < len) {
+      in++;
+    }
+  }
+
+  return out;
+}
+
+size_t
+http_parser_normalize_path(char *buf, size_t buflen, struct http_parser_url *u,
+                           unsigned int flags)
+{
+  uint16_t off;
+  uint16_t len;
+  uint16_t shift;
+  unsigned int i;
+
+  if ((u->field_set & (1 << UF_PATH)) == 0) {
+    return buflen;
+  }
+
+  off = u->field_data[UF_PATH].off;
+  len = u->field_data[UF_PATH].len;
+  assert((size_t) (off + len) <= buflen);
+
+  shift = (uint16_t) (len - normalize_path(buf + off, len, flags));
+  if (shift == 0) {
+    return buflen;
+  }
+
+  /* Move the query string and fragment down to the new end of the path */
+  memmove(buf + off + len - shift, buf + off + len, buflen - off - len);
+
+  u->field_data[UF_PATH].len -= shift;
+  for (i = 0; i < UF_MAX; i++) {
+    if ((u->field_set & (1 << i)) && u->field_data[i].off > off) {
+      u->field_data[i].off -= shift;
+    }
+  }
+
+  return buflen - shift;
+}
+
+enum http_route_state
+  { s_route_start = 0
+  , s_route_authority
+  , s_route_path
+  , s_route_done
+  , s_route_miss
+  };
+
+void
+http_route_trie_init(struct http_route_trie *trie,
+                     struct http_route_node *nodes,
+                     uint32_t max_nodes)
+{
+  assert(max_nodes > 0);
+
+  trie->nodes = nodes;
+  trie->num_nodes = 1;
+  trie->max_nodes = max_nodes;
+
+  memset(&nodes[0], 0, sizeof(nodes[0]));
+  nodes[0].id = -1;
+  nodes[0].prefix_id = -1;
+}
+
+int
+http_route_trie_add(struct http_route_trie *trie,
+                    const char *route,
+                    size_t len,
+                    int32_t id)
+{
+  struct http_route_node *nodes = trie->nodes;
+  uint32_t node = 0;
+  uint32_t child;
+  int prefix = 0;
+  size_t i;
+
+  assert(id >= 0);
+
+  if (len > 0 && route[len - 1] == '*') {
+    prefix = 1;
+    len--;
+  }
+
+  for (i = 0; i < len; i++) {
+    for (child = nodes[node].child; child != 0; child = nodes[child].sibling) {
+      if (nodes[child].ch == (unsigned char) route[i]) {
+        break;
+      }
+    }
+
+    if (child == 0) {
+      if (trie->num_nodes == trie->max_nodes) {
+        return 1;
+      }
+
+      child = trie->num_nodes++;
+      nodes[child].ch = (unsigned char) route[i];
+      nodes[child].child = 0;
+      nodes[child].sibling = nodes[node].child;
+      nodes[child].id = -1;
+      nodes[child].prefix_id = -1;
+      nodes[node].child = child;
+    }
+
+    node = child;
+  }
+
+  if (prefix) {
+    nodes[node].prefix_id = id;
+  } else {
+    nodes[node].id = id;
+  }
+
+  return 0;
+}
+
+void
+http_route_cursor_init(struct http_route_cursor *cursor,
+                       const struct http_route_trie *trie)
+{
+  cursor->trie = trie;
+  cursor->node = 0;
+  cursor->prefix_id = -1;
+  cursor->state = s_route_start;
+  cursor->slashes = 0;
+}
+
+/* Match the implicit "/" path of an absolute-form target with an empty
+ * path, like "http://host" or "http://host?q"; returns the new state
+ */
+static unsigned char
+route_empty_path(struct http_route_cursor *cursor)
+{
+  const struct http_route_node *nodes = cursor->trie->nodes;
+  uint32_t child;
+
+  cursor->prefix_id = nodes[0].prefix_id;
+  for (child = nodes[0].child; child != 0; child = nodes[child].sibling) {
+    if (nodes[child].ch == '/') {
+      break;
+    }
+  }
+
+  if (child == 0) {
+    return s_route_miss;
+  }
+
+  cursor->node = child;
+  if (nodes[child].prefix_id != -1) {
+    cursor->prefix_id = nodes[child].prefix_id;
+  }
+  return s_route_done;
+}
+
+void
+http_route_cursor_feed(struct http_route_cursor *cursor,
+                       const char *at,
+                       size_t len)
+{
+  const struct http_route_node *nodes = cursor->trie->nodes;
+  const char *p;
+  uint32_t child;
+  char ch;
+
+  for (p = at; p != at + len; p++) {
+    ch = *p;
+
+    switch (cursor->state) {
+      case s_route_start:
+        if (ch != '/') {
+          /* absolute-form; the path starts at the third slash */
+          cursor->state = s_route_authority;
+          break;
+        }
+
+path_start:
+        cursor->state = s_route_path;
+        cursor->prefix_id = nodes[0].prefix_id;
+
+        /* fall through */
+      case s_route_path:
+        if (ch == '?' || ch == '#') {
+          cursor->state = s_route_done;
+          return;
+        }
+
+        for (child = nodes[cursor->node].child;
+             child != 0;
+             child = nodes[child].sibling) {
+          if (nodes[child].ch == (unsigned char) ch) {
+            break;
+          }
+        }
+
+        if (child == 0) {
+          cursor->state = s_route_miss;
+          return;
+        }
+
+        cursor->node = child;
+        if (nodes[child].prefix_id != -1) {
+          cursor->prefix_id = nodes[child].prefix_id;
+        }
+        break;
+
+      case s_route_authority:
+        if (ch == '?' || ch == '#') {
+          cursor->state = cursor->slashes == 2 ? route_empty_path(cursor)
+                                               : s_route_miss;
+          return;
+        }
+
+        if (ch == '/' && ++cursor->slashes == 3) {
+          /* This slash is the first byte of the path */
+          goto path_start;
+        }
+        break;
+
+      default:
+        return;
+    }
+  }
+}
+
+int32_t
+http_route_cursor_result(const struct http_route_cursor *cursor)
+{
+  struct http_route_cursor root;
+  int32_t id;
+
+  switch (cursor->state) {
+    case s_route_authority:
+      if (cursor->slashes != 2) {
+        return -1;
+      }
+      /* The URL ended with the authority */
+      root = *cursor;
+      root.state = route_empty_path(&root);
+      return http_route_cursor_result(&root);
+
+    case s_route_path:
+    case s_route_done:
+      id = cursor->trie->nodes[cursor->node].id;
+      return id != -1 ? id : cursor->prefix_id;
+
+    case s_route_miss:
+      return cursor->prefix_id;
+
+    default:
+      return -1;
+  }
+}
+
+void
+http_header_filter_init(struct http_header_filter *filter,
+                        struct http_header_filter_node *nodes,
+                        uint32_t max_nodes)
+{
+  assert(max_nodes > 0);
+
+  filter->nodes = nodes;
+  filter->num_nodes = 1;
+  filter->max_nodes = max_nodes;
+
+  memset(&nodes[0], 0, sizeof(nodes[0]));
+}
+
+int
+http_header_filter_add(struct http_header_filter *filter,
+                       const char *name,
+                       size_t len)
+{
+  struct http_header_filter_node *nodes = filter->nodes;
+  uint32_t node = 0;
+  uint32_t child;
+  unsigned char c;
+  size_t i;
+
+  if (len == 0) {
+    return 1;
+  }
+
+  for (i = 0; i < len; i++) {
+    c = (unsigned char) STRICT_TOKEN(name[i]);
+    if (!c) {
+      return 1;
+    }
+
+    for (child = nodes[node].child; child != 0; child = nodes[child].sibling) {
+      if (nodes[child].ch == c) {
+        break;
+      }
+    }
+
+    if (child == 0) {
+      if (filter->num_nodes == filter->max_nodes) {
+        return 1;
+      }
+
+      child = filter->num_nodes++;
+      nodes[child].ch = c;
+      nodes[child].match = 0;
+      nodes[child].child = 0;
+      nodes[child].sibling = nodes[node].child;
+      nodes[node].child = child;
+    }
+
+    node = child;
+  }
+
+  nodes[node].match = 1;
+  return 0;
+}
+
+int
+http_header_filter_match(const struct http_header_filter *filter,
+                         const char *name,
+                         size_t len)
+{
+  const struct http_header_filter_node *nodes = filter->nodes;
+  uint32_t node = 0;
+  uint32_t child;
+  unsigned char c;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    c = (unsigned char) STRICT_TOKEN(name[i]);
+
+    for (child = nodes[node].child; child != 0; child = nodes[child].sibling) {
+      if (nodes[child].ch == c) {
+        break;
+      }
+    }
+
+    if (child == 0) {
+      return 0;
+    }
+
+    node = child;
+  }
+
+  return nodes[node].match;
+}
+
 void
 http_parser_pause(http_parser *parser, int paused) {
   /* Users should only be pausing/unpausing a parser that is not in an error
@@ -2550,8 +3649,7 @@ http_parser_pause(http_parser *parser, int paused) {
    */
   if (HTTP_PARSER_ERRNO(parser) == HPE_OK ||
       HTTP_PARSER_ERRNO(parser) == HPE_PAUSED) {
-    uint32_t nread = parser->nread; /* used by the SET_ERRNO macro */
-    SET_ERRNO((paused) ? HPE_PAUSED : HPE_OK);
+    parser->http_errno = (paused) ? HPE_PAUSED : HPE_OK;
   } else {
     assert(0 && "Attempting to pause parser in error state");
   }
@@ -2562,6 +3660,105 @@ http_body_is_final(const struct http_parser *parser) {
     return parser->state == s_message_done;
 }
 
+uint64_t
+http_parser_body_remaining(const http_parser *parser) {
+  int hasBody;
+
+  switch (parser->state) {
+    case s_body_identity:
+    case s_chunk_data:
+      return parser->content_length;
+
+    case s_headers_done:
+      /* Paused from on_headers_complete, before the final LF; tell what
+       * s_headers_done will make of the body once that LF is parsed.
+       * Chunked bodies start with a chunk size line, not with data.
+       */
+      hasBody = parser->flags & F_CHUNKED ||
+        (parser->content_length > 0 && parser->content_length != ULLONG_MAX);
+      if ((parser->flags & (F_SKIPBODY | F_CHUNKED)) ||
+          (parser->upgrade && (parser->method == HTTP_CONNECT || !hasBody))) {
+        return 0;
+      }
+      if (parser->uses_transfer_encoding == 1) {
+        return parser->type == HTTP_REQUEST && !parser->lenient_http_headers ?
+               0 : ULLONG_MAX;
+      }
+      if (parser->content_length != ULLONG_MAX) {
+        return parser->content_length;
+      }
+      return http_message_needs_eof(parser) ? ULLONG_MAX : 0;
+
+    case s_body_identity_eof:
+      return ULLONG_MAX;
+
+    default:
+      return 0;
+  }
+}
+
+uint64_t
+http_parser_bytes_expected(const http_parser *parser) {
+  if (HTTP_PARSER_ERRNO(parser) != HPE_OK) {
+    return 0;
+  }
+
+  switch (parser->state) {
+    case s_dead:
+      return 0;
+
+    case s_body_identity:
+    case s_body_identity_eof:
+    case s_chunk_data:
+      return http_parser_body_remaining(parser);
+
+    case s_chunk_data_almost_done:
+      return 2;
+
+    default:
+      return 1;
+  }
+}
+
+int
+http_parser_consume_body(http_parser *parser,
+                         const http_parser_settings *settings,
+                         uint64_t nbytes) {
+  uint64_t remaining = http_parser_body_remaining(parser);
+
+  if (HTTP_PARSER_ERRNO(parser) != HPE_OK || nbytes > remaining) {
+    return 1;
+  }
+
+  if (nbytes == 0 || remaining == ULLONG_MAX) {
+    return 0;
+  }
+
+  parser->content_length -= nbytes;
+  if (parser->content_length != 0 || parser->state == s_headers_done) {
+    /* Before the final LF of the headers, parsing that LF ends the message
+     * if the whole body has been skipped
+     */
+    return 0;
+  }
+
+  if (parser->state == s_chunk_data) {
+    /* The CRLF after the chunk is left to http_parser_execute() */
+    parser->state = s_chunk_data_almost_done;
+    return 0;
+  }
+
+  /* Same as s_message_done */
+  parser->state = NEW_MESSAGE();
+  if (settings->on_message_complete != NULL &&
+      settings->on_message_complete(parser) != 0) {
+    parser->http_errno = HPE_CB_message_complete;
+    return 1;
+  }
+
+  return 0;
+}
+
 unsigned long
 http_parser_version(void) {
   return HTTP_PARSER_VERSION_MAJOR * 0x10000 |
@@ -26,8 +26,8 @@ extern "C" {
 
 /* Also update SONAME in the Makefile whenever you change these. */
 #define HTTP_PARSER_VERSION_MAJOR 2
-#define HTTP_PARSER_VERSION_MINOR 9
-#define HTTP_PARSER_VERSION_PATCH 4
+#define HTTP_PARSER_VERSION_MINOR 10
+#define HTTP_PARSER_VERSION_PATCH 0
 
 #include <stddef.h>
 #if defined(_WIN32) && !defined(__MINGW32__) && \
@@ -89,6 +89,9 @@ typedef struct http_parser_settings http_parser_settings;
  */
 typedef int (*http_data_cb) (http_parser*, const char *at, size_t length);
 typedef int (*http_cb) (http_parser*);
+typedef int (*http_header_cb) (http_parser*,
+                               const char *field, size_t field_length,
+                               const char *value, size_t value_length);
 
 
 /* Status Codes */
@@ -280,6 +283,11 @@ enum flags
   XX(UNKNOWN, "an unknown error occurred")                           \
   XX(INVALID_TRANSFER_ENCODING,                                      \
      "request has invalid transfer-encoding")                        \
+  XX(CB_request_line_complete,                                       \
+     "the on_request_line_complete callback failed")                 \
+  XX(CB_status_line_complete,                                        \
+     "the on_status_line_complete callback failed")                  \
+  XX(CB_header, "the on_header callback failed")                     \
 
 
 /* Define HPE_* values for each errno value above */
@@ -345,6 +353,23 @@ struct http_parser_settings {
    */
   http_cb      on_chunk_header;
   http_cb      on_chunk_complete;
+  /* Called once the request line (method, URL and version) or the status
+   * line has been parsed, before any header is seen.
+   */
+  http_cb      on_request_line_complete;
+  http_cb      on_status_line_complete;
+  /* When on_header is set, it is called once per header line with both the
+   * field and the value, and on_header_field/on_header_value are not used.
+   * A header line is never split across http_parser_execute() calls: if the
+   * data ends inside one, http_parser_execute() returns the offset at which
+   * the line starts without an error and the caller must pass the remaining
+   * bytes again together with more data.
+   */
+  http_header_cb on_header;
+  /* With on_header, only headers whose name is in this filter are passed to
+   * it. The others are still parsed and validated. NULL passes all headers.
+   */
+  const struct http_header_filter *header_filter;
 };
 
 
@@ -378,6 +403,69 @@ struct http_parser_url {
 };
 
 
+/* Flag values for http_parser_normalize_path() */
+enum http_path_flags
+  { HTTP_PATH_REMOVE_DOT_SEGMENTS = 1 << 0 /* RFC 3986, section 5.2.4 */
+  , HTTP_PATH_MERGE_SLASHES       = 1 << 1 /* "//" becomes "/" */
+  , HTTP_PATH_DECODE_UNRESERVED   = 1 << 2 /* "%7E" becomes "~" */
+  };
+
+
+/* Route matching.
+ *
+ * A route table is compiled once into a trie stored in caller-provided
+ * nodes and can then be shared by any number of connections. Each
+ * connection keeps an http_route_cursor which is fed the `on_url` data as
+ * it arrives, so the matching route is known as soon as the request line is
+ * complete, without buffering the URL.
+ *
+ * A route matches the path of the URL exactly; a route ending in '*' matches
+ * any path starting with the part before the '*'. Exact matches win over
+ * prefix matches and longer prefixes win over shorter ones.
+ */
+struct http_route_node {
+  uint32_t child;               /* Index of first child, 0 if none */
+  uint32_t sibling;             /* Index of next sibling, 0 if none */
+  int32_t id;                   /* Exact route id or -1 */
+  int32_t prefix_id;            /* Prefix route id or -1 */
+  unsigned char ch;
+};
+
+struct http_route_trie {
+  struct http_route_node *nodes;
+  uint32_t num_nodes;
+  uint32_t max_nodes;
+};
+
+struct http_route_cursor {
+  /** PRIVATE **/
+  const struct http_route_trie *trie;
+  uint32_t node;
+  int32_t prefix_id;
+  unsigned char state;
+  unsigned char slashes;
+};
+
+/* Header filter.
+ *
+ * The set of header names an application cares about is compiled once into
+ * a trie stored in caller-provided nodes. Names are matched case-insensitively
+ * and a filter can be shared by any number of parsers through
+ * http_parser_settings.header_filter.
+ */
+struct http_header_filter_node {
+  uint32_t child;               /* Index of first child, 0 if none */
+  uint32_t sibling;             /* Index of next sibling, 0 if none */
+  unsigned char ch;             /* Lowercase name byte */
+  unsigned char match;          /* A name ends here */
+};
+
+struct http_header_filter {
+  struct http_header_filter_node *nodes;
+  uint32_t num_nodes;
+  uint32_t max_nodes;
+};
+
 /* Returns the library version. Bits 16-23 contain the major version number,
  * bits 8-15 the minor version number and bits 0-7 the patch level.
  * Usage example:
@@ -406,6 +494,33 @@ size_t http_parser_execute(http_parser *parser,
                            size_t len);
 
 
+/* Like http_parser_execute(), but parses at most `max_bytes` bytes and stops
+ * after `max_messages` on_message_complete callbacks; 0 means no limit.
+ * Returns the number of parsed bytes without setting an error, so an event
+ * loop can pass the rest of `data` on a later turn. With `on_header` set,
+ * `max_bytes` must exceed the longest header line.
+ */
+size_t http_parser_execute_budget(http_parser *parser,
+                                  const http_parser_settings *settings,
+                                  const char *data,
+                                  size_t len,
+                                  size_t max_bytes,
+                                  size_t max_messages);
+
+
+/* Runs http_parser_execute() for `n` connections, storing each result in
+ * `nparsed[i]`. The parser and data of the next connections are prefetched
+ * while the current one is parsed, which pays off when an event loop wakes
+ * up with many ready connections whose state is no longer in cache.
+ */
+void http_parser_execute_batch(http_parser *const parsers[],
+                               const http_parser_settings *settings,
+                               const char *const bufs[],
+                               const size_t lens[],
+                               size_t nparsed[],
+                               size_t n);
+
+
 /* If http_should_keep_alive() in the on_headers_complete or
  * on_message_complete callback returns 0, then this should be
  * the last message on the connection.
@@ -434,12 +549,94 @@ int http_parser_parse_url(const char *buf, size_t buflen,
                           int is_connect,
                           struct http_parser_url *u);
 
+/* Normalize the UF_PATH field of a URL previously parsed with
+ * http_parser_parse_url(). `flags` is a bitmask of HTTP_PATH_* values.
+ *
+ * The path is rewritten in place in a single pass; percent-decoding happens
+ * before dot-segment removal so "/%2e%2e/" is treated as "/../". Fields that
+ * follow the path are moved down and their offsets in `u` are updated.
+ * Returns the new length of `buf`.
+ */
+size_t http_parser_normalize_path(char *buf, size_t buflen,
+                                  struct http_parser_url *u,
+                                  unsigned int flags);
+
+/* Initialize an empty route trie in `nodes`. `max_nodes` must be at least 1;
+ * each route needs at most one node per byte.
+ */
+void http_route_trie_init(struct http_route_trie *trie,
+                          struct http_route_node *nodes,
+                          uint32_t max_nodes);
+
+/* Add a route with a non-negative `id`; return nonzero if the trie is full */
+int http_route_trie_add(struct http_route_trie *trie,
+                        const char *route,
+                        size_t len,
+                        int32_t id);
+
+/* Reset a cursor; do this in on_message_begin */
+void http_route_cursor_init(struct http_route_cursor *cursor,
+                            const struct http_route_trie *trie);
+
+/* Advance a cursor by `len` bytes of URL; call this from on_url */
+void http_route_cursor_feed(struct http_route_cursor *cursor,
+                            const char *at,
+                            size_t len);
+
+/* Return the id of the matched route, or -1 if no route matched */
+int32_t http_route_cursor_result(const struct http_route_cursor *cursor);
+
+/* Initialize an empty header filter in `nodes`. `max_nodes` must be at
+ * least 1; each name needs at most one node per byte.
+ */
+void http_header_filter_init(struct http_header_filter *filter,
+                             struct http_header_filter_node *nodes,
+                             uint32_t max_nodes);
+
+/* Add a header name; return nonzero if the filter is full or `name` is not
+ * a valid header name
+ */
+int http_header_filter_add(struct http_header_filter *filter,
+                           const char *name,
+                           size_t len);
+
+/* Return nonzero if the header name `name` is in the filter */
+int http_header_filter_match(const struct http_header_filter *filter,
+                             const char *name,
+                             size_t len);
+
 /* Pause or un-pause the parser; a nonzero value pauses */
 void http_parser_pause(http_parser *parser, int paused);
 
 /* Checks if this is the final chunk of the body. */
 int http_body_is_final(const http_parser *parser);
 
+/* Number of body bytes the parser expects next: the rest of a
+ * Content-Length body or of the current chunk, ULLONG_MAX for a body that
+ * ends at EOF, or 0 if the parser is not in the middle of a body. When
+ * paused from on_headers_complete it already tells the length of a
+ * Content-Length or EOF body; the final LF of the headers is still to be
+ * passed to http_parser_execute() and may come after the skipped bytes.
+ */
+uint64_t http_parser_body_remaining(const http_parser *parser);
+
+/* Number of bytes to pass to http_parser_execute() next so as not to read
+ * past the current body: the exact rest of a Content-Length body or chunk,
+ * 2 for the CRLF after a chunk, ULLONG_MAX for a body that ends at EOF and
+ * 1 when the parser can't tell. Return 0 if the parser can't make progress
+ * (an error, a pause or a closed connection).
+ */
+uint64_t http_parser_bytes_expected(const http_parser *parser);
+
+/* Skip `nbytes` body bytes that were consumed without the parser, e.g.
+ * with splice(). on_body is not called for them; on_message_complete is
+ * if they end a Content-Length body. Return nonzero if `nbytes` is more
+ * than http_parser_body_remaining(), or on error.
+ */
+int http_parser_consume_body(http_parser *parser,
+                             const http_parser_settings *settings,
+                             uint64_t nbytes);
+
 /* Change the maximum header size provided at compile time. */
 void http_parser_set_max_header_size(uint32_t size);
 
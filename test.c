@@ -25,6 +25,7 @@
 #include <stdlib.h> /* rand */
 #include <string.h>
 #include <stdarg.h>
+#include <limits.h> /* ULLONG_MAX */
 
 #if defined(__APPLE__)
 # undef strlncpy
@@ -80,6 +81,7 @@ struct message {
   int headers_complete_cb_called;
   int message_complete_cb_called;
   int status_cb_called;
+  int line_complete_cb_called;
   int message_complete_on_eof;
   int body_is_final;
   int allow_chunked_length;
@@ -2257,6 +2259,37 @@ header_value_cb (http_parser *p, const char *buf, size_t len)
   return 0;
 }
 
+int
+header_cb (http_parser *p,
+           const char *field, size_t field_len,
+           const char *value, size_t value_len)
+{
+  assert(p == &parser);
+  struct message *m = &messages[num_messages];
+  char *dst;
+  size_t i;
+
+  assert(m->num_headers < MAX_HEADERS);
+  strlncpy(m->headers[m->num_headers][0],
+           sizeof(m->headers[m->num_headers][0]),
+           field,
+           field_len);
+
+  /* Folded values are passed with their line breaks; drop them here so that
+   * they compare equal to what on_header_value produces.
+   */
+  dst = m->headers[m->num_headers][1];
+  for (i = 0; i < value_len && dst < m->headers[m->num_headers][2] - 1; i++) {
+    if (value[i] != '\r' && value[i] != '\n') {
+      *dst++ = value[i];
+    }
+  }
+  *dst = '\0';
+
+  m->num_headers++;
+  return 0;
+}
+
 void
 check_body_is_final (const http_parser *p)
 {
@@ -2303,10 +2336,35 @@ message_begin_cb (http_parser *p)
   return 0;
 }
 
+int
+request_line_complete_cb (http_parser *p)
+{
+  assert(p == &parser);
+  assert(parser.type == HTTP_REQUEST);
+  assert(!messages[num_messages].line_complete_cb_called);
+  assert(!messages[num_messages].num_headers);
+  assert(*messages[num_messages].request_url);
+  messages[num_messages].line_complete_cb_called = TRUE;
+  return 0;
+}
+
+int
+status_line_complete_cb (http_parser *p)
+{
+  assert(p == &parser);
+  assert(parser.type == HTTP_RESPONSE);
+  assert(!messages[num_messages].line_complete_cb_called);
+  assert(!messages[num_messages].num_headers);
+  assert(messages[num_messages].status_cb_called);
+  messages[num_messages].line_complete_cb_called = TRUE;
+  return 0;
+}
+
 int
 headers_complete_cb (http_parser *p)
 {
   assert(p == &parser);
+  assert(messages[num_messages].line_complete_cb_called);
   messages[num_messages].method = parser.method;
   messages[num_messages].status_code = parser.status_code;
   messages[num_messages].http_major = parser.http_major;
@@ -2461,6 +2519,24 @@ dontcall_response_status_cb (http_parser *p, const char *buf, size_t len)
   abort();
 }
 
+int
+dontcall_request_line_complete_cb (http_parser *p)
+{
+  if (p) { } // gcc
+  fprintf(stderr, "\n\n*** on_request_line_complete() called on paused "
+                  "parser ***\n\n");
+  abort();
+}
+
+int
+dontcall_status_line_complete_cb (http_parser *p)
+{
+  if (p) { } // gcc
+  fprintf(stderr, "\n\n*** on_status_line_complete() called on paused "
+                  "parser ***\n\n");
+  abort();
+}
+
 int
 dontcall_chunk_header_cb (http_parser *p)
 {
@@ -2489,6 +2565,8 @@ static http_parser_settings settings_dontcall =
   ,.on_message_complete = dontcall_message_complete_cb
   ,.on_chunk_header = dontcall_chunk_header_cb
   ,.on_chunk_complete = dontcall_chunk_complete_cb
+  ,.on_request_line_complete = dontcall_request_line_complete_cb
+  ,.on_status_line_complete = dontcall_status_line_complete_cb
   };
 
 /* These pause_* callbacks always pause the parser and just invoke the regular
@@ -2551,6 +2629,22 @@ pause_message_complete_cb (http_parser *p)
   return message_complete_cb(p);
 }
 
+int
+pause_request_line_complete_cb (http_parser *p)
+{
+  http_parser_pause(p, 1);
+  *current_pause_parser = settings_dontcall;
+  return request_line_complete_cb(p);
+}
+
+int
+pause_status_line_complete_cb (http_parser *p)
+{
+  http_parser_pause(p, 1);
+  *current_pause_parser = settings_dontcall;
+  return status_line_complete_cb(p);
+}
+
 int
 pause_response_status_cb (http_parser *p, const char *buf, size_t len)
 {
@@ -2600,6 +2694,8 @@ static http_parser_settings settings_pause =
   ,.on_message_complete = pause_message_complete_cb
   ,.on_chunk_header = pause_chunk_header_cb
   ,.on_chunk_complete = pause_chunk_complete_cb
+  ,.on_request_line_complete = pause_request_line_complete_cb
+  ,.on_status_line_complete = pause_status_line_complete_cb
   };
 
 static http_parser_settings settings =
@@ -2613,6 +2709,22 @@ static http_parser_settings settings =
   ,.on_message_complete = message_complete_cb
   ,.on_chunk_header = chunk_header_cb
   ,.on_chunk_complete = chunk_complete_cb
+  ,.on_request_line_complete = request_line_complete_cb
+  ,.on_status_line_complete = status_line_complete_cb
+  };
+
+static http_parser_settings settings_on_header =
+  {.on_message_begin = message_begin_cb
+  ,.on_header = header_cb
+  ,.on_url = request_url_cb
+  ,.on_status = response_status_cb
+  ,.on_body = body_cb
+  ,.on_headers_complete = headers_complete_cb
+  ,.on_message_complete = message_complete_cb
+  ,.on_chunk_header = chunk_header_cb
+  ,.on_chunk_complete = chunk_complete_cb
+  ,.on_request_line_complete = request_line_complete_cb
+  ,.on_status_line_complete = status_line_complete_cb
   };
 
 static http_parser_settings settings_count_body =
@@ -2626,6 +2738,8 @@ static http_parser_settings settings_count_body =
   ,.on_message_complete = message_complete_cb
   ,.on_chunk_header = chunk_header_cb
   ,.on_chunk_complete = chunk_complete_cb
+  ,.on_request_line_complete = request_line_complete_cb
+  ,.on_status_line_complete = status_line_complete_cb
   };
 
 static http_parser_settings settings_connect =
@@ -2639,6 +2753,8 @@ static http_parser_settings settings_connect =
   ,.on_message_complete = connect_message_complete_cb
   ,.on_chunk_header = chunk_header_cb
   ,.on_chunk_complete = chunk_complete_cb
+  ,.on_request_line_complete = request_line_complete_cb
+  ,.on_status_line_complete = status_line_complete_cb
   };
 
 static http_parser_settings settings_null =
@@ -2652,6 +2768,8 @@ static http_parser_settings settings_null =
   ,.on_message_complete = 0
   ,.on_chunk_header = 0
   ,.on_chunk_complete = 0
+  ,.on_request_line_complete = 0
+  ,.on_status_line_complete = 0
   };
 
 void
@@ -2776,6 +2894,7 @@ message_eq (int index, int connect, const struct message *expected)
   }
 
   assert(m->message_begin_cb_called);
+  assert(m->line_complete_cb_called);
   assert(m->headers_complete_cb_called);
   assert(m->message_complete_cb_called);
 
@@ -3592,6 +3711,178 @@ test_parse_url (void)
   }
 }
 
+struct normalize_path_test {
+  const char *url;
+  unsigned int flags;
+  const char *expected;
+  const char *query;
+};
+
+#define NORMALIZE_ALL (HTTP_PATH_REMOVE_DOT_SEGMENTS | \
+                       HTTP_PATH_MERGE_SLASHES | \
+                       HTTP_PATH_DECODE_UNRESERVED)
+
+const struct normalize_path_test normalize_path_tests[] =
+{ {"/a/b/c/./../../g", HTTP_PATH_REMOVE_DOT_SEGMENTS, "/a/g", NULL}
+, {"/mid/content=5/../6", HTTP_PATH_REMOVE_DOT_SEGMENTS, "/mid/6", NULL}
+, {"/../../a", HTTP_PATH_REMOVE_DOT_SEGMENTS, "/a", NULL}
+, {"/a/b/..", HTTP_PATH_REMOVE_DOT_SEGMENTS, "/a/", NULL}
+, {"/a/.", HTTP_PATH_REMOVE_DOT_SEGMENTS, "/a/", NULL}
+, {"/a/..b/.c", HTTP_PATH_REMOVE_DOT_SEGMENTS, "/a/..b/.c", NULL}
+, {"/a//../b", HTTP_PATH_REMOVE_DOT_SEGMENTS, "/a/b", NULL}
+, {"//a///b//", HTTP_PATH_MERGE_SLASHES, "/a/b/", NULL}
+, {"/%7Euser/%2F%41", HTTP_PATH_DECODE_UNRESERVED, "/~user/%2FA", NULL}
+, {"/a/%2e%2E/b", HTTP_PATH_DECODE_UNRESERVED, "/a/../b", NULL}
+, {"/a/%2e%2E/b", NORMALIZE_ALL, "/b", NULL}
+, {"/a/%2", NORMALIZE_ALL, "/a/%2", NULL}
+, {"/a/./b//../c?x=/./..#frag", NORMALIZE_ALL, "/a/c?x=/./..#frag", "x=/./.."}
+, {"http://host:80//x/../y?q", NORMALIZE_ALL, "http://host:80/y?q", "q"}
+, {"/a/b", 0, "/a/b", NULL}
+, {"*", NORMALIZE_ALL, "*", NULL}
+};
+
+void
+test_normalize_path (void)
+{
+  const struct normalize_path_test *test;
+  struct http_parser_url u;
+  char buf[256];
+  size_t len;
+  unsigned int i;
+  int rv;
+
+  for (i = 0; i < ARRAY_SIZE(normalize_path_tests); i++) {
+    test = &normalize_path_tests[i];
+
+    len = strlen(test->url);
+    memcpy(buf, test->url, len);
+    http_parser_url_init(&u);
+    rv = http_parser_parse_url(buf, len, 0, &u);
+    assert(rv == 0);
+
+    len = http_parser_normalize_path(buf, len, &u, test->flags);
+    if (len != strlen(test->expected) ||
+        memcmp(buf, test->expected, len) != 0) {
+      printf("\n*** http_parser_normalize_path(\"%s\") gave \"%.*s\", "
+             "expected \"%s\" ***\n\n",
+             test->url, (int) len, buf, test->expected);
+      abort();
+    }
+
+    assert(u.field_data[UF_PATH].off + u.field_data[UF_PATH].len <= len);
+    if (test->query) {
+      assert(u.field_set & (1 << UF_QUERY));
+      assert(u.field_data[UF_QUERY].len == strlen(test->query));
+      assert(0 == memcmp(buf + u.field_data[UF_QUERY].off,
+                         test->query,
+                         u.field_data[UF_QUERY].len));
+    }
+  }
+}
+
+static const struct {
+  const char *route;
+  int32_t id;
+} route_table[] =
+{ {"/", 0}
+, {"/api/users", 1}
+, {"/api/users/*", 2}
+, {"/static/*", 3}
+, {"/api/*", 4}
+};
+
+static const struct {
+  const char *url;
+  int32_t id;
+} route_tests[] =
+{ {"/", 0}
+, {"/api/users", 1}
+, {"/api/users?id=1", 1}
+, {"/api/users#top", 1}
+, {"/api/users/42", 2}
+, {"/api/other", 4}
+, {"/static/app.css", 3}
+, {"/ap", -1}
+, {"/nothing", -1}
+, {"http://example.com/api/users?x", 1}
+, {"http://example.com", 0}
+, {"http://example.com?q=1", 0}
+, {"http://example.com/", 0}
+, {"*", -1}
+};
+
+static struct http_route_cursor route_cursor;
+
+int
+route_message_begin_cb (http_parser *p)
+{
+  http_route_cursor_init(&route_cursor, p->data);
+  return 0;
+}
+
+int
+route_url_cb (http_parser *p, const char *buf, size_t len)
+{
+  (void)p;
+  http_route_cursor_feed(&route_cursor, buf, len);
+  return 0;
+}
+
+void
+test_route_match (void)
+{
+  http_parser_settings route_settings;
+  struct http_route_node nodes[64];
+  struct http_route_trie trie;
+  http_parser parser;
+  char buf[256];
+  size_t buflen;
+  size_t split;
+  size_t nparsed;
+  unsigned int i;
+  int rv;
+
+  http_route_trie_init(&trie, nodes, 3);
+  assert(http_route_trie_add(&trie, "/a", 2, 0) == 0);
+  assert(http_route_trie_add(&trie, "/b", 2, 1) != 0);
+
+  http_route_trie_init(&trie, nodes, ARRAY_SIZE(nodes));
+  for (i = 0; i < ARRAY_SIZE(route_table); i++) {
+    rv = http_route_trie_add(&trie,
+                             route_table[i].route,
+                             strlen(route_table[i].route),
+                             route_table[i].id);
+    assert(rv == 0);
+  }
+
+  http_parser_settings_init(&route_settings);
+  route_settings.on_message_begin = route_message_begin_cb;
+  route_settings.on_url = route_url_cb;
+
+  for (i = 0; i < ARRAY_SIZE(route_tests); i++) {
+    buflen = sprintf(buf, "OPTIONS %s HTTP/1.1\r\n\r\n", route_tests[i].url);
+
+    for (split = 1; split < buflen; split++) {
+      http_parser_init(&parser, HTTP_REQUEST);
+      parser.data = &trie;
+
+      nparsed = http_parser_execute(&parser, &route_settings, buf, split);
+      assert(nparsed == split);
+      nparsed = http_parser_execute(&parser, &route_settings,
+                                    buf + split, buflen - split);
+      assert(nparsed == buflen - split);
+
+      if (http_route_cursor_result(&route_cursor) != route_tests[i].id) {
+        printf("\n*** route match for \"%s\" (split %u) gave %d, "
+               "expected %d ***\n\n",
+               route_tests[i].url, (unsigned int) split,
+               http_route_cursor_result(&route_cursor), route_tests[i].id);
+        abort();
+      }
+    }
+  }
+}
+
 void
 test_method_str (void)
 {
@@ -3677,6 +3968,123 @@ test_message (const struct message *message)
   }
 }
 
+/* Like test_message() but with on_header, which hands unfinished header lines
+ * back; those bytes are passed again together with the rest of the message.
+ */
+void
+test_message_on_header (const struct message *message)
+{
+  size_t raw_len = strlen(message->raw);
+  size_t msg1len;
+  size_t read;
+  size_t read1;
+
+  for (msg1len = 0; msg1len < raw_len; msg1len++) {
+    parser_init(message->type);
+    if (message->allow_chunked_length) {
+      parser.allow_chunked_length = 1;
+    }
+
+    currently_parsing_eof = 0;
+    read1 = http_parser_execute(&parser, &settings_on_header,
+                                message->raw, msg1len);
+    assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+    assert(read1 <= msg1len);
+
+    if (message->upgrade && parser.upgrade && num_messages > 0) {
+      messages[num_messages - 1].upgrade = message->raw + read1;
+      goto test;
+    }
+
+    if (!messages[0].headers_complete_cb_called && parser.nread != read1) {
+      print_error(message->raw, read1);
+      abort();
+    }
+
+    read = http_parser_execute(&parser, &settings_on_header,
+                               message->raw + read1, raw_len - read1);
+
+    if (message->upgrade && parser.upgrade) {
+      messages[num_messages - 1].upgrade = message->raw + read1 + read;
+      goto test;
+    }
+
+    if (read != raw_len - read1) {
+      print_error(message->raw, read1 + read);
+      abort();
+    }
+
+    currently_parsing_eof = 1;
+    read = http_parser_execute(&parser, &settings_on_header, NULL, 0);
+    if (read != 0) {
+      print_error(message->raw, read);
+      abort();
+    }
+
+  test:
+    if (num_messages != 1) {
+      printf("\n*** num_messages != 1 after testing '%s' with on_header ***\n\n",
+             message->name);
+      abort();
+    }
+
+    if (!message_eq(0, 0, message)) abort();
+  }
+}
+
+void
+test_header_filter (void)
+{
+  const char *buf =
+    "POST /filter HTTP/1.1\r\n"
+    "Hos: a\r\n"
+    "Host: example.com\r\n"
+    "Hosts: b\r\n"
+    "X-Request-Id: 42\r\n"
+    "Content-Length: 5\r\n"
+    "Accept: */*\r\n"
+    "\r\n"
+    "hello";
+  size_t buflen = strlen(buf);
+  http_parser_settings filter_settings = settings_on_header;
+  struct http_header_filter_node nodes[64];
+  struct http_header_filter filter;
+  size_t split;
+  size_t read;
+
+  http_header_filter_init(&filter, nodes, 3);
+  assert(http_header_filter_add(&filter, "ab", 2) == 0);
+  assert(http_header_filter_add(&filter, "c", 1) != 0);
+
+  http_header_filter_init(&filter, nodes, ARRAY_SIZE(nodes));
+  assert(http_header_filter_add(&filter, "Bad Name", 8) != 0);
+  assert(http_header_filter_add(&filter, "", 0) != 0);
+  assert(http_header_filter_add(&filter, "host", 4) == 0);
+  assert(http_header_filter_add(&filter, "x-request-id", 12) == 0);
+  assert(http_header_filter_add(&filter, "CONTENT-TYPE", 12) == 0);
+  filter_settings.header_filter = &filter;
+
+  for (split = 0; split < buflen; split++) {
+    parser_init(HTTP_REQUEST);
+    currently_parsing_eof = 0;
+
+    read = http_parser_execute(&parser, &filter_settings, buf, split);
+    assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+    read += http_parser_execute(&parser, &filter_settings,
+                                buf + read, buflen - read);
+    assert(read == buflen);
+
+    assert(num_messages == 1);
+    assert(messages[0].message_complete_cb_called);
+    assert(messages[0].num_headers == 2);
+    assert(strcmp(messages[0].headers[0][0], "Host") == 0);
+    assert(strcmp(messages[0].headers[0][1], "example.com") == 0);
+    assert(strcmp(messages[0].headers[1][0], "X-Request-Id") == 0);
+    assert(strcmp(messages[0].headers[1][1], "42") == 0);
+    assert(strcmp(messages[0].body, "hello") == 0);
+  }
+}
+
 void
 test_message_count_body (const struct message *message)
 {
@@ -3776,6 +4184,9 @@ test_invalid_header_field_content_error (int req)
 {
   test_invalid_header_content(req, "Foo: F\01ailure");
   test_invalid_header_content(req, "Foo: B\02ar");
+  test_invalid_header_content(req,
+      "Foo: 0123456789abcdef0123456789abcdef\01ailure");
+  test_invalid_header_content(req, "Foo: 0123456789abcdef01\177ar");
 }
 
 void
@@ -3946,6 +4357,470 @@ test_header_overflow_error (int req)
 }
 
 
+/* The header size limit is enforced on the exact byte that exceeds it, however
+ * the data is split, and the count restarts for chunk headers and trailers.
+ */
+void
+test_header_size_limit (void)
+{
+  const char *req =
+    "GET / HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "Accept: */*\r\n"
+    "\r\n";
+  const char *res_head =
+    "HTTP/1.1 200 OK\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n";
+  const char *res =
+    "HTTP/1.1 200 OK\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "5\r\nhello\r\n"
+    "6\r\n world\r\n"
+    "0\r\n"
+    "Vary: *\r\n"
+    "\r\n";
+  size_t req_len = strlen(req);
+  size_t res_len = strlen(res);
+  http_parser parser;
+  size_t split;
+  size_t parsed;
+
+  for (split = 0; split <= req_len; split++) {
+    http_parser_set_max_header_size(req_len);
+    http_parser_init(&parser, HTTP_REQUEST);
+    parsed = http_parser_execute(&parser, &settings_null, req, split);
+    parsed += http_parser_execute(&parser, &settings_null,
+                                  req + split, req_len - split);
+    assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+    assert(parsed == req_len);
+
+    http_parser_set_max_header_size(req_len - 1);
+    http_parser_init(&parser, HTTP_REQUEST);
+    parsed = http_parser_execute(&parser, &settings_null, req, split);
+    if (parsed == split) {
+      parsed += http_parser_execute(&parser, &settings_null,
+                                    req + split, req_len - split);
+    }
+    assert(HTTP_PARSER_ERRNO(&parser) == HPE_HEADER_OVERFLOW);
+    assert(parsed == req_len - 1);
+    assert(parser.nread == req_len);
+  }
+
+  for (split = 0; split <= res_len; split++) {
+    http_parser_set_max_header_size(strlen(res_head));
+    http_parser_init(&parser, HTTP_RESPONSE);
+    parsed = http_parser_execute(&parser, &settings_null, res, split);
+    parsed += http_parser_execute(&parser, &settings_null,
+                                  res + split, res_len - split);
+    assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+    assert(parsed == res_len);
+  }
+
+  http_parser_set_max_header_size(HTTP_MAX_HEADER_SIZE);
+}
+
+int
+fail_cb (http_parser *p)
+{
+  (void)p;
+  return -1;
+}
+
+int
+fail_data_cb (http_parser *p, const char *buf, size_t len)
+{
+  (void)p;
+  (void)buf;
+  (void)len;
+  return 1;
+}
+
+/* A callback error in the headers leaves the header bytes counted so far in
+ * parser->nread, whether the line was parsed in one go or byte by byte.
+ */
+void
+test_callback_error_nread (void)
+{
+  const char *req =
+    "GET /x HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "Accept: */*\r\n"
+    "\r\n";
+  const struct {
+    enum http_errno err;
+    size_t parsed;
+    uint32_t nread;
+  } cases[] =
+    { { HPE_CB_url, 7, 17 }
+    , { HPE_CB_header_field, 22, 36 }
+    , { HPE_CB_header_value, 35, 36 }
+    , { HPE_CB_headers_complete, 50, 51 }
+    };
+  size_t req_len = strlen(req);
+  http_parser_settings settings;
+  http_parser parser;
+  size_t split;
+  size_t parsed;
+  unsigned int i;
+
+  for (i = 0; i < ARRAY_SIZE(cases); i++) {
+    memset(&settings, 0, sizeof(settings));
+    switch (cases[i].err) {
+      case HPE_CB_url: settings.on_url = fail_data_cb; break;
+      case HPE_CB_header_field: settings.on_header_field = fail_data_cb; break;
+      case HPE_CB_header_value: settings.on_header_value = fail_data_cb; break;
+      default: settings.on_headers_complete = fail_cb; break;
+    }
+
+    http_parser_init(&parser, HTTP_REQUEST);
+    parsed = http_parser_execute(&parser, &settings, req, req_len);
+    assert(HTTP_PARSER_ERRNO(&parser) == cases[i].err);
+    assert(parsed == cases[i].parsed);
+    assert(parser.nread == cases[i].nread);
+
+    for (split = 1; split < req_len; split++) {
+      http_parser_init(&parser, HTTP_REQUEST);
+      parsed = http_parser_execute(&parser, &settings, req, split);
+      if (HTTP_PARSER_ERRNO(&parser) == HPE_OK) {
+        parsed += http_parser_execute(&parser, &settings,
+                                      req + split, req_len - split);
+      }
+      /* A span cut by the split is passed, and fails, early */
+      assert(HTTP_PARSER_ERRNO(&parser) == cases[i].err);
+      assert(parsed <= cases[i].parsed);
+      assert(parser.nread >= parsed && parser.nread <= cases[i].nread);
+    }
+  }
+}
+
+static int split_messages;
+
+int
+count_message_cb (http_parser *p)
+{
+  (void)p;
+  split_messages++;
+  return 0;
+}
+
+/* Parse `buf` in one go or byte by byte; returns the bytes parsed */
+static size_t
+parse_split (const char *buf, size_t len, int bytewise,
+             enum http_errno *err, int *messages)
+{
+  http_parser_settings settings;
+  http_parser parser;
+  size_t parsed = 0;
+  size_t n;
+
+  memset(&settings, 0, sizeof(settings));
+  settings.on_message_complete = count_message_cb;
+  split_messages = 0;
+
+  http_parser_init(&parser, HTTP_REQUEST);
+  if (!bytewise) {
+    parsed = http_parser_execute(&parser, &settings, buf, len);
+  } else {
+    for (; parsed < len; parsed += n) {
+      n = http_parser_execute(&parser, &settings, buf + parsed, 1);
+      if (n != 1 || (parser.upgrade && split_messages > 0)) {
+        parsed += n;
+        break;
+      }
+    }
+  }
+
+  if (HTTP_PARSER_ERRNO(&parser) == HPE_OK && !parser.upgrade) {
+    http_parser_execute(&parser, &settings, NULL, 0);
+  }
+
+  *err = HTTP_PARSER_ERRNO(&parser);
+  *messages = split_messages;
+  return parsed;
+}
+
+/* The fast header path must leave to s_header_field every name that the
+ * latter acts on, also names that only start like one of the special ones.
+ * Append a byte to each header name and compare with a byte by byte parse.
+ */
+void
+test_header_name_split (const struct message *msg)
+{
+  static const char suffixes[] = "0-s ";
+  const char *raw = msg->raw;
+  const char *end = strstr(raw, "\r\n\r\n");
+  size_t len = strlen(raw);
+  char *buf = malloc(len + 1);
+  const char *line;
+  const char *colon;
+  enum http_errno err[2];
+  int messages[2];
+  size_t parsed[2];
+  unsigned int i;
+
+  assert(buf != NULL);
+  if (end == NULL) {
+    end = raw + len;
+  }
+
+  for (line = strstr(raw, "\r\n"); line != NULL && line < end;
+       line = strstr(line + 2, "\r\n")) {
+    colon = strchr(line + 2, ':');
+    if (colon == NULL || colon > end || memchr(line + 2, '\n', colon - line - 2)) {
+      continue;
+    }
+
+    for (i = 0; i < sizeof(suffixes) - 1; i++) {
+      memcpy(buf, raw, colon - raw);
+      buf[colon - raw] = suffixes[i];
+      memcpy(buf + (colon - raw) + 1, colon, len - (colon - raw));
+
+      parsed[0] = parse_split(buf, len + 1, 0, &err[0], &messages[0]);
+      parsed[1] = parse_split(buf, len + 1, 1, &err[1], &messages[1]);
+      if (parsed[0] != parsed[1] || err[0] != err[1] ||
+          messages[0] != messages[1]) {
+        fprintf(stderr, "\n*** %s: header name split mismatch: %u %s %d, "
+                "byte by byte %u %s %d ***\n\n%.*s\n", msg->name,
+                (unsigned) parsed[0], http_errno_name(err[0]), messages[0],
+                (unsigned) parsed[1], http_errno_name(err[1]), messages[1],
+                (int) (len + 1), buf);
+        abort();
+      }
+    }
+  }
+
+  free(buf);
+}
+
+/* Body bytes skipped with http_parser_consume_body() count towards the body
+ * but are never passed to on_body.
+ */
+void
+test_body_bypass (void)
+{
+  const char *req =
+    "POST / HTTP/1.1\r\n"
+    "Content-Length: 10\r\n"
+    "\r\n"
+    "0123456789"
+    "GET /next HTTP/1.1\r\n"
+    "\r\n";
+  const char *res =
+    "HTTP/1.1 200 OK\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "5\r\nhello\r\n"
+    "6\r\n world\r\n"
+    "0\r\n"
+    "\r\n";
+  const char *eof_res =
+    "HTTP/1.1 200 OK\r\n"
+    "\r\n"
+    "abc";
+  size_t head_len = strstr(req, "0123") - req;
+  http_parser_settings pause_settings;
+  size_t parsed;
+
+  /* Content-Length body, 3 bytes parsed and 7 skipped */
+  parser_init(HTTP_REQUEST);
+  parsed = parse(req, head_len + 3);
+  assert(parsed == head_len + 3);
+  assert(http_parser_body_remaining(&parser) == 7);
+  assert(http_parser_consume_body(&parser, &settings, 8) != 0);
+  assert(http_parser_consume_body(&parser, &settings, 4) == 0);
+  assert(http_parser_body_remaining(&parser) == 3);
+  assert(num_messages == 0);
+  assert(http_parser_consume_body(&parser, &settings, 3) == 0);
+  assert(num_messages == 1);
+  assert(messages[0].message_complete_cb_called);
+  assert(strcmp(messages[0].body, "012") == 0);
+  assert(http_parser_body_remaining(&parser) == 0);
+  assert(http_parser_consume_body(&parser, &settings, 1) != 0);
+
+  parsed = parse(req + head_len + 10, strlen(req) - head_len - 10);
+  assert(parsed == strlen(req) - head_len - 10);
+  assert(num_messages == 2);
+  assert(strcmp(messages[1].request_url, "/next") == 0);
+
+  /* Paused from on_headers_complete: the whole body skipped before the
+   * final LF of the headers is parsed
+   */
+  parser_init(HTTP_REQUEST);
+  pause_settings = settings;
+  pause_settings.on_headers_complete = pause_headers_complete_cb;
+  current_pause_parser = &pause_settings;
+  parsed = http_parser_execute(&parser, &pause_settings, req, head_len);
+  assert(parsed == head_len - 1);
+  assert(HTTP_PARSER_ERRNO(&parser) == HPE_PAUSED);
+  assert(http_parser_body_remaining(&parser) == 10);
+  http_parser_pause(&parser, 0);
+  assert(http_parser_consume_body(&parser, &settings, 11) != 0);
+  assert(http_parser_consume_body(&parser, &settings, 10) == 0);
+  assert(num_messages == 0);
+  assert(parse(req + head_len - 1, 1) == 1);
+  assert(num_messages == 1);
+  assert(messages[0].body_size == 0);
+  parsed = parse(req + head_len + 10, strlen(req) - head_len - 10);
+  assert(parsed == strlen(req) - head_len - 10);
+  assert(num_messages == 2);
+
+  /* Chunked body, nothing to skip before the first chunk size */
+  parser_init(HTTP_RESPONSE);
+  pause_settings = settings;
+  pause_settings.on_headers_complete = pause_headers_complete_cb;
+  current_pause_parser = &pause_settings;
+  head_len = strstr(res, "5\r\n") - res;
+  parsed = http_parser_execute(&parser, &pause_settings, res, head_len);
+  assert(parsed == head_len - 1);
+  assert(http_parser_body_remaining(&parser) == 0);
+
+  /* Chunked body, the second chunk's payload skipped */
+  parser_init(HTTP_RESPONSE);
+  head_len = strstr(res, " world") - res;
+  parsed = parse(res, head_len);
+  assert(parsed == head_len);
+  assert(http_parser_body_remaining(&parser) == 6);
+  assert(http_parser_consume_body(&parser, &settings, 6) == 0);
+  assert(http_parser_body_remaining(&parser) == 0);
+  assert(num_messages == 0);
+  parsed = parse(res + head_len + 6, strlen(res) - head_len - 6);
+  assert(parsed == strlen(res) - head_len - 6);
+  assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+  assert(num_messages == 1);
+  assert(strcmp(messages[0].body, "hello") == 0);
+
+  /* Body up to EOF */
+  parser_init(HTTP_RESPONSE);
+  parsed = parse(eof_res, strlen(eof_res) - 3);
+  assert(parsed == strlen(eof_res) - 3);
+  assert(http_parser_body_remaining(&parser) == ULLONG_MAX);
+  assert(http_parser_consume_body(&parser, &settings, 3) == 0);
+  parse(NULL, 0);
+  assert(num_messages == 1);
+  assert(messages[0].body_size == 0);
+}
+
+/* Feeding exactly http_parser_bytes_expected() bytes at a time never reads
+ * into the next message.
+ */
+void
+test_bytes_expected (void)
+{
+  const char *res =
+    "HTTP/1.1 200 OK\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "\r\n"
+    "5\r\nhello\r\n"
+    "0\r\n"
+    "\r\n"
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Length: 6\r\n"
+    "\r\n"
+    "world!";
+  size_t head_len = strstr(res, "5\r\n") - res;
+  size_t len = strlen(res);
+  size_t off;
+  uint64_t expected;
+
+  parser_init(HTTP_RESPONSE);
+  assert(http_parser_bytes_expected(&parser) == 1);
+
+  assert(parse(res, head_len + 3) == head_len + 3);
+  assert(http_parser_bytes_expected(&parser) == 5);
+  assert(parse(res + head_len + 3, 5) == 5);
+  assert(http_parser_bytes_expected(&parser) == 2);
+
+  for (off = head_len + 8; off < len; off += (size_t) expected) {
+    expected = http_parser_bytes_expected(&parser);
+    assert(expected >= 1 && expected <= len - off);
+    if (strncmp(res + off, "world!", 6) == 0) {
+      assert(expected == 6);
+    }
+    assert(parse(res + off, (size_t) expected) == expected);
+  }
+
+  assert(num_messages == 2);
+  assert(strcmp(messages[1].body, "world!") == 0);
+
+  assert(parse("x", 1) != 1);
+  assert(http_parser_bytes_expected(&parser) == 0);
+}
+
+/* A budget stops http_parser_execute_budget() between pipelined messages or
+ * after a byte count, without an error, and the rest parses as usual.
+ */
+void
+test_execute_budget (void)
+{
+  const char *req =
+    "GET /1 HTTP/1.1\r\n\r\n"
+    "POST /2 HTTP/1.1\r\nContent-Length: 4\r\n\r\nbody"
+    "POST /3 HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nhi\r\n0\r\n\r\n"
+    "GET /4 HTTP/1.1\r\n\r\n";
+  size_t len = strlen(req);
+  size_t first = strlen("GET /1 HTTP/1.1\r\n\r\n");
+  size_t off, nparsed;
+
+  parser_init(HTTP_REQUEST);
+  nparsed = http_parser_execute_budget(&parser, &settings, req, len, 0, 1);
+  assert(nparsed == first);
+  assert(num_messages == 1);
+  assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+
+  off = nparsed;
+  nparsed = http_parser_execute_budget(&parser, &settings, req + off,
+                                       len - off, 0, 2);
+  off += nparsed;
+  assert(num_messages == 3);
+  assert(strcmp(messages[1].body, "body") == 0);
+  assert(strcmp(messages[2].body, "hi") == 0);
+  assert(strncmp(req + off, "GET /4", 6) == 0);
+
+  while (off < len) {
+    nparsed = http_parser_execute_budget(&parser, &settings, req + off,
+                                         len - off, 3, 0);
+    assert(nparsed >= 1 && nparsed <= 3);
+    assert(HTTP_PARSER_ERRNO(&parser) == HPE_OK);
+    off += nparsed;
+  }
+  assert(num_messages == 4);
+  assert(strcmp(messages[3].request_url, "/4") == 0);
+}
+
+void
+test_execute_batch (void)
+{
+  const char *bufs[] = {
+    "GET / HTTP/1.1\r\n\r\n",
+    "POST /x HTTP/1.1\r\nContent-Length: 10\r\n\r\n01234",
+    "GET / HTTP/1.1\r\nBad Header\r\n\r\n",
+    ""
+  };
+  http_parser parsers[4];
+  http_parser *ptrs[4];
+  size_t lens[4];
+  size_t nparsed[4];
+  size_t i;
+
+  for (i = 0; i < 4; i++) {
+    http_parser_init(&parsers[i], HTTP_REQUEST);
+    ptrs[i] = &parsers[i];
+    lens[i] = strlen(bufs[i]);
+  }
+
+  http_parser_execute_batch(ptrs, &settings_null, bufs, lens, nparsed, 4);
+
+  assert(nparsed[0] == lens[0]);
+  assert(nparsed[1] == lens[1]);
+  assert(http_parser_body_remaining(&parsers[1]) == 5);
+  assert(nparsed[2] < lens[2]);
+  assert(HTTP_PARSER_ERRNO(&parsers[2]) == HPE_INVALID_HEADER_TOKEN);
+  assert(nparsed[3] == 0);
+  assert(HTTP_PARSER_ERRNO(&parsers[3]) == HPE_OK);
+}
+
 void
 test_header_nread_value ()
 {
@@ -4354,11 +5229,20 @@ main (void)
   //// API
   test_preserve_data();
   test_parse_url();
+  test_normalize_path();
+  test_route_match();
+  test_header_filter();
   test_method_str();
   test_status_str();
 
   //// NREAD
   test_header_nread_value();
+  test_header_size_limit();
+  test_callback_error_nread();
+  test_body_bypass();
+  test_bytes_expected();
+  test_execute_budget();
+  test_execute_batch();
 
   //// OVERFLOW CONDITIONS
   test_no_overflow_parse_url();
@@ -4445,6 +5329,10 @@ main (void)
     test_message_pause(&responses[i]);
   }
 
+  for (i = 0; i < ARRAY_SIZE(responses); i++) {
+    test_message_on_header(&responses[i]);
+  }
+
   for (i = 0; i < ARRAY_SIZE(responses); i++) {
     test_message_connect(&responses[i]);
   }
@@ -4528,6 +5416,9 @@ main (void)
   test_simple("GET / HTTP/1.1\r\n"
               "Test: Düsseldorf\r\n",
               HPE_OK);
+  test_simple("GET / HTTP/1.1\r\n"
+              "Test: Düsseldorf\tDüsseldorf\tDüsseldorf\tDüsseldorf\r\n",
+              HPE_OK);
 
   // Well-formed but incomplete
   test_simple("GET / HTTP/1.1\r\n"
@@ -4543,6 +5434,14 @@ main (void)
               "\r\n",
               HPE_INVALID_TRANSFER_ENCODING);
 
+  // A name starting with Transfer-Encoding counts as one, in one go too
+  test_simple("POST / HTTP/1.1\r\n"
+              "Transfer-Encoding0: chunked\r\n"
+              "\r\n"
+              "GET /smuggled HTTP/1.1\r\n"
+              "\r\n",
+              HPE_INVALID_TRANSFER_ENCODING);
+
   static const char *all_methods[] = {
     "DELETE",
     "GET",
@@ -4689,6 +5588,14 @@ main (void)
     test_message_pause(&requests[i]);
   }
 
+  for (i = 0; i < ARRAY_SIZE(requests); i++) {
+    test_message_on_header(&requests[i]);
+  }
+
+  for (i = 0; i < ARRAY_SIZE(requests); i++) {
+    test_header_name_split(&requests[i]);
+  }
+
   for (i = 0; i < ARRAY_SIZE(requests); i++) {
     if (!requests[i].should_keep_alive) continue;
     for (j = 0; j < ARRAY_SIZE(requests); j++) {